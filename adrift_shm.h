@@ -0,0 +1,67 @@
+#ifndef ADRIFT_SHM_H
+#define ADRIFT_SHM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// The layout of the shared memory segment adrift publishes its state in,
+// for overlays and bots. It's named by the shm_name config key, and can be
+// opened read-only with shm_open. Everything is in host byte order.
+//
+// The segment is a struct adrift_shm, followed by a table of capacity
+// splits. It's guarded by seq, which is odd while adrift is writing: a
+// reader copies what it needs between reading seq before and after, and
+// tries again if seq was odd or changed. adrift never waits for readers.
+//
+// The table only grows. If capacity is more than was mapped, the segment
+// must be mapped again. See shm_reader.c for a reader
+
+#define ADRIFT_SHM_MAGIC "adriftS"
+#define ADRIFT_SHM_VERSION 1
+#define ADRIFT_SHM_NAME_SIZE 64
+
+struct adrift_shm_state {
+	int32_t active_split; // -1 if no run is in progress
+	uint32_t nsplits; // Splits in the table
+	uint32_t profile; // Index of the active profile
+	// Changes whenever anything in the table or the names changes, so it
+	// needn't be copied otherwise
+	uint32_t layout_gen;
+
+	// Microseconds, and UINT64_MAX if not known
+	uint64_t timer;
+	uint64_t split_time;
+	uint64_t sum_of_best;
+	uint64_t best_possible_time;
+	// The timer minus the PB's time at the active split, or INT64_MIN if
+	// there's no run or no PB
+	int64_t delta;
+
+	// Truncated to fit
+	char game[ADRIFT_SHM_NAME_SIZE];
+	char category[ADRIFT_SHM_NAME_SIZE];
+};
+
+// A split, in the order of the splits file. Groups aren't included
+struct adrift_shm_split {
+	// Cumulative, and UINT64_MAX if not present
+	uint64_t cur;
+	uint64_t pb;
+	// Of this split alone
+	uint64_t best;
+	uint32_t depth; // How many groups it's in
+	uint32_t golded; // Nonzero if it's a gold this run
+	char name[ADRIFT_SHM_NAME_SIZE];
+};
+
+struct adrift_shm {
+	char magic[8];
+	uint32_t version;
+	uint32_t capacity;
+	_Atomic uint32_t seq;
+	uint32_t pad;
+	struct adrift_shm_state state;
+	struct adrift_shm_split splits[];
+};
+
+#endif
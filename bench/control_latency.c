@@ -0,0 +1,175 @@
+#include "control.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Measures how long a command sent to a running adrift's control socket
+// takes to show up: it subscribes, then repeatedly starts and resets a
+// run, timing each command until the pushed active split reflects it.
+// Exits 1 if the 99th percentile is over a frame at 60Hz.
+//
+// It really does start and reset runs, so point it at adrift running a
+// throwaway profile. Resets with no splits done don't change any times
+
+#define DEFAULT_CYCLES 200
+#define DEFAULT_GAP_MS 20
+#define DEFAULT_BUDGET_US 16667
+#define TIMEOUT_MS 1000
+
+static int _fd;
+static uint8_t _buf[4096];
+static size_t _len;
+
+static uint64_t _now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool _send(uint8_t type) {
+	struct control_hdr hdr = { .type = type };
+	return write(_fd, &hdr, sizeof hdr) == sizeof hdr;
+}
+
+// Wait until a message pushed to us says the active split is want.
+// Returns false on timeout or if adrift went away
+static bool _wait_active(int64_t want) {
+	uint64_t deadline = _now_ns() + TIMEOUT_MS * 1000000ull;
+
+	while (true) {
+		// Everything buffered, a message at a time
+		size_t off = 0;
+		bool found = false;
+		while (_len - off >= sizeof (struct control_hdr)) {
+			struct control_hdr hdr;
+			memcpy(&hdr, _buf + off, sizeof hdr);
+			if (_len - off - sizeof hdr < hdr.len) break;
+			const uint8_t *payload = _buf + off + sizeof hdr;
+			off += sizeof hdr + hdr.len;
+
+			int64_t active;
+			if (hdr.type == CONTROL_STATE && hdr.len >= sizeof (struct control_state)) {
+				struct control_state st;
+				memcpy(&st, payload, sizeof st);
+				active = st.active_split;
+			} else if (hdr.type == CONTROL_DELTA && hdr.len >= sizeof (uint32_t) + sizeof (uint64_t)) {
+				// The active split comes first if it's there
+				uint32_t mask;
+				memcpy(&mask, payload, sizeof mask);
+				if (!(mask & CONTROL_F_ACTIVE_SPLIT)) continue;
+				memcpy(&active, payload + sizeof mask, sizeof active);
+			} else {
+				continue;
+			}
+
+			if (active == want) found = true;
+		}
+
+		memmove(_buf, _buf + off, _len - off);
+		_len -= off;
+		if (found) return true;
+
+		int64_t left = (int64_t)(deadline - _now_ns()) / 1000000;
+		if (left <= 0) return false;
+
+		struct pollfd pfd = { .fd = _fd, .events = POLLIN };
+		if (poll(&pfd, 1, left) <= 0) continue;
+
+		ssize_t n = read(_fd, _buf + _len, sizeof _buf - _len);
+		if (n <= 0) return false;
+		_len += n;
+	}
+}
+
+static int _cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void _report(const char *label, uint64_t *lat, long n) {
+	qsort(lat, n, sizeof lat[0], _cmp_u64);
+	printf("%-6s  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", label, lat[n / 2] / 1e3, lat[n * 99 / 100] / 1e3, lat[n - 1] / 1e3);
+}
+
+int main(int argc, char **argv) {
+	long ncycles = DEFAULT_CYCLES, gap_ms = DEFAULT_GAP_MS, budget_us = DEFAULT_BUDGET_US;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:g:b:h")) != -1) {
+		switch (opt) {
+		case 'n': ncycles = atol(optarg); break;
+		case 'g': gap_ms = atol(optarg); break;
+		case 'b': budget_us = atol(optarg); break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind != argc - 1 || ncycles < 1) goto usage;
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(argv[optind]) >= sizeof addr.sun_path) goto usage;
+	strcpy(addr.sun_path, argv[optind]);
+
+	_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (_fd == -1 || connect(_fd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+		fprintf(stderr, "Failed to connect to %s\n", argv[optind]);
+		return 1;
+	}
+
+	// Start from no run, whatever adrift was doing
+	if (!_send(CONTROL_SUBSCRIBE) || !_send(CONTROL_RESET) || !_wait_active(-1)) {
+		fputs("adrift didn't reset\n", stderr);
+		return 1;
+	}
+
+	uint64_t *start_lat = malloc(ncycles * sizeof start_lat[0]);
+	uint64_t *reset_lat = malloc(ncycles * sizeof reset_lat[0]);
+	struct timespec gap = { .tv_sec = gap_ms / 1000, .tv_nsec = gap_ms % 1000 * 1000000 };
+
+	for (long i = 0; i < ncycles; ++i) {
+		uint64_t t0 = _now_ns();
+		if (!_send(CONTROL_START) || !_wait_active(0)) {
+			fputs("Timed out waiting for a start\n", stderr);
+			return 1;
+		}
+		start_lat[i] = _now_ns() - t0;
+		nanosleep(&gap, NULL);
+
+		t0 = _now_ns();
+		if (!_send(CONTROL_RESET) || !_wait_active(-1)) {
+			fputs("Timed out waiting for a reset\n", stderr);
+			return 1;
+		}
+		reset_lat[i] = _now_ns() - t0;
+		nanosleep(&gap, NULL);
+	}
+
+	uint64_t worst = 0;
+	_report("start", start_lat, ncycles);
+	if (start_lat[ncycles * 99 / 100] > worst) worst = start_lat[ncycles * 99 / 100];
+	_report("reset", reset_lat, ncycles);
+	if (reset_lat[ncycles * 99 / 100] > worst) worst = reset_lat[ncycles * 99 / 100];
+
+	free(start_lat);
+	free(reset_lat);
+	close(_fd);
+
+	if (worst > (uint64_t)budget_us * 1000) {
+		fprintf(stderr, "p99 of %.1f us is over the budget of %ld us\n", worst / 1e3, budget_us);
+		return 1;
+	}
+
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-n cycles] [-g gap ms] [-b p99 budget us] control_socket\n", argv[0]);
+	return 1;
+}
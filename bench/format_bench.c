@@ -0,0 +1,165 @@
+#include "common.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Compares format_time with the snprintf formatter it replaced: checks
+// they produce the same text for random times at every precision and
+// prefix, then times both, and format_time_cell with and without the
+// cell already holding the time. Exits 1 if any output differs
+
+#define DEFAULT_CHECKS 5000000
+#define DEFAULT_CALLS 10000000
+
+// The formatter as it was before format_time, verbatim
+static const char *_snprintf_format_time(uint64_t total, char prefix, int prec) {
+	if (total == UINT64_MAX) return "-";
+
+	static char buf[64];
+
+	// The logic for calculating frac is pretty simple but it's still
+	// easier to just switch on the precision
+	uint64_t frac;
+	switch (prec) {
+	case 0:
+		frac = 0;
+		break;
+	case 1:
+		frac = (total / 100000) % 10;
+		break;
+	case 2:
+		frac = (total / 10000) % 100;
+		break;
+	case 3:
+		frac = (total / 1000) % 1000;
+		break;
+	case 4:
+		frac = (total / 100) % 10000;
+		break;
+	case 5:
+		frac = (total / 10) % 100000;
+		break;
+	case 6:
+	default:
+		frac = total % 1000000;
+		break;
+	}
+
+	total /= 1000000;
+	uint64_t secs = total % 60;
+	total /= 60;
+	uint64_t mins = total % 60;
+	total /= 60;
+	uint64_t hrs = total;
+
+	char *ptr = buf;
+	size_t bufsz = sizeof buf;
+	if (prefix) {
+		buf[0] = prefix;
+		++ptr;
+		--bufsz;
+	}
+
+	if (hrs) {
+		snprintf(ptr, bufsz, "%"PRIu64":%02"PRIu64":%02"PRIu64".%0*"PRIu64, hrs, mins, secs, prec, frac);
+	} else if (mins) {
+		snprintf(ptr, bufsz, "%"PRIu64":%02"PRIu64".%0*"PRIu64, mins, secs, prec, frac);
+	} else {
+		snprintf(ptr, bufsz, "%"PRIu64".%0*"PRIu64, secs, prec, frac);
+	}
+
+	return buf;
+}
+
+static uint64_t _xorshift(uint64_t *x) {
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static double _elapsed_ns(struct timespec *start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char **argv) {
+	long nchecks = DEFAULT_CHECKS, ncalls = DEFAULT_CALLS;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "c:n:h")) != -1) {
+		switch (opt) {
+		case 'c': nchecks = atol(optarg); break;
+		case 'n': ncalls = atol(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-c checks] [-n calls]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// Times of up to about a minute, an hour and a day, so every format is
+	// covered
+	static const uint64_t ranges[] = { 100000000, 4000000000, 100000000000 };
+	static const char prefixes[] = { 0, '+', '-' };
+
+	uint64_t x = 88172645463325252ull;
+	char buf[TIME_BUF_SIZE];
+
+	for (long i = 0; i < nchecks; ++i) {
+		uint64_t t = i == 0 ? UINT64_MAX : _xorshift(&x) % ranges[i % 3];
+		char prefix = prefixes[i / 3 % 3];
+		int prec = i % 7;
+
+		const char *want = _snprintf_format_time(t, prefix, prec);
+		const char *got = format_time(buf, t, prefix, prec);
+		if (strcmp(want, got)) {
+			fprintf(stderr, "Mismatch for %"PRIu64" at precision %d: '%s', expected '%s'\n", t, prec, got, want);
+			return 1;
+		}
+	}
+
+	printf("checked:          %ld times, all identical\n", nchecks);
+
+	// The timer as it's drawn: a new value each frame, at 3 places
+	volatile char sink;
+	uint64_t t = 0;
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < ncalls; ++i) {
+		t += 16667;
+		sink = _snprintf_format_time(t, 0, 3)[0];
+	}
+	printf("snprintf:         %.1f ns/call\n", _elapsed_ns(&start) / ncalls);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < ncalls; ++i) {
+		t += 16667;
+		sink = format_time(buf, t, 0, 3)[0];
+	}
+	printf("format_time:      %.1f ns/call\n", _elapsed_ns(&start) / ncalls);
+
+	struct time_cell cell = { .prec = -1 };
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < ncalls; ++i) {
+		t += 16667;
+		sink = format_time_cell(&cell, t, 0, 3)[0];
+	}
+	printf("cell, changed:    %.1f ns/call\n", _elapsed_ns(&start) / ncalls);
+
+	// A split's delta, which stays the same from frame to frame
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < ncalls; ++i) {
+		sink = format_time_cell(&cell, t, 0, 3)[0];
+	}
+	printf("cell, unchanged:  %.1f ns/call\n", _elapsed_ns(&start) / ncalls);
+
+	(void)sink;
+
+	return 0;
+}
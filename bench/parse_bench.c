@@ -0,0 +1,243 @@
+#include "timer.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Fuzzes timer_parse_line against a straightforward reference parser
+// built on strtoull and strcmp, on random lines made of numbers, spaces,
+// event names and junk, then times it on lines like a splitter sends,
+// beside the strtol and strcmp chain it replaced. Exits 1 if the parsers
+// ever disagree
+
+#define DEFAULT_CHECKS 5000000
+#define DEFAULT_LINES 20000000
+#define MAX_LINE 96
+#define NCORPUS 4096
+
+static const struct {
+	const char *name;
+	enum timer_event ev;
+} _events[] = {
+	{ "BEGIN", TIMER_EV_BEGIN },
+	{ "RESET", TIMER_EV_RESET },
+	{ "SPLIT", TIMER_EV_SPLIT },
+	{ "PAUSE", TIMER_EV_PAUSE },
+	{ "RESUME", TIMER_EV_RESUME },
+};
+
+#define NEVENTS (sizeof _events / sizeof _events[0])
+
+// The same grammar, written for clarity rather than speed. UINT64_MAX
+// means no time elsewhere, so it's too large here
+static enum timer_parse_error _ref_parse_line(const char *str, struct timer_line *line) {
+	*line = (struct timer_line){ .ev = TIMER_EV_NONE };
+
+	const char *p = str;
+	for (int field = 0; field < 2 && *p >= '0' && *p <= '9'; ++field) {
+		char *end;
+		errno = 0;
+		unsigned long long val = strtoull(p, &end, 10);
+		if (errno == ERANGE || val >= UINT64_MAX) return TIMER_PARSE_BAD_TIME;
+		p = end;
+
+		if (*p == ' ') {
+			++p;
+		} else if (*p) {
+			return TIMER_PARSE_BAD_TIME;
+		}
+
+		if (field == 0) {
+			line->has_time = true;
+			line->time = val;
+		} else {
+			line->has_real_time = true;
+			line->real_time = val;
+		}
+	}
+
+	if (!*p) return TIMER_PARSE_OK;
+
+	for (size_t i = 0; i < NEVENTS; ++i) {
+		if (!strcmp(p, _events[i].name)) {
+			line->ev = _events[i].ev;
+			return TIMER_PARSE_OK;
+		}
+	}
+
+	return TIMER_PARSE_BAD_EVENT;
+}
+
+// The parsing half of timer_parse as it was before timer_parse_line
+static int _strtol_parse_line(const char *str, long *us, enum timer_event *ev) {
+	char *end;
+	*us = strtol(str, &end, 10);
+	*ev = TIMER_EV_NONE;
+
+	if (end == str) return 1;
+
+	if (end[0] == ' ') {
+		++end;
+		if (!strcmp(end, "BEGIN")) {
+			*ev = TIMER_EV_BEGIN;
+		} else if (!strcmp(end, "RESET")) {
+			*ev = TIMER_EV_RESET;
+		} else if (!strcmp(end, "SPLIT")) {
+			*ev = TIMER_EV_SPLIT;
+		} else if (end[0] != '\0') {
+			return 1;
+		}
+	} else if (end[0] != '\0') {
+		return 1;
+	}
+
+	return 0;
+}
+
+static uint64_t _xorshift(uint64_t *x) {
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+// Append a random piece of a line: mostly the pieces of valid lines, with
+// numbers around the overflow boundary, near misses of event names, and
+// the odd junk byte
+static size_t _fuzz_piece(char *buf, size_t len, uint64_t *x) {
+	static const char *const edges[] = {
+		"0", "18446744073709551614", "18446744073709551615",
+		"18446744073709551616", "99999999999999999999", "000000000000000000000001",
+	};
+	static const char *const near[] = { "SPLI", "SPLITS", "split", "PAUSED", "RESUM", "BEGIN ", "" };
+
+	size_t room = MAX_LINE - len;
+	char piece[32];
+	size_t n;
+
+	switch (_xorshift(x) % 8) {
+	case 0:
+	case 1:
+		n = sprintf(piece, "%"PRIu64, _xorshift(x) >> (_xorshift(x) % 64));
+		break;
+	case 2:
+		n = sprintf(piece, "%s", edges[_xorshift(x) % (sizeof edges / sizeof edges[0])]);
+		break;
+	case 3:
+	case 4:
+		piece[0] = ' ';
+		n = 1;
+		break;
+	case 5:
+		n = sprintf(piece, "%s", _events[_xorshift(x) % NEVENTS].name);
+		break;
+	case 6:
+		n = sprintf(piece, "%s", near[_xorshift(x) % (sizeof near / sizeof near[0])]);
+		break;
+	default:
+		// Any byte but the terminator, including ones with the top bit set
+		piece[0] = _xorshift(x) % 255 + 1;
+		n = 1;
+		break;
+	}
+
+	if (n > room) n = room;
+	memcpy(buf + len, piece, n);
+	return len + n;
+}
+
+static double _elapsed_ns(struct timespec *start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char **argv) {
+	long nchecks = DEFAULT_CHECKS, nlines = DEFAULT_LINES;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "c:n:h")) != -1) {
+		switch (opt) {
+		case 'c': nchecks = atol(optarg); break;
+		case 'n': nlines = atol(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-c checks] [-n lines]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	uint64_t x = 88172645463325252ull;
+	char buf[MAX_LINE + 1];
+	long nvalid = 0;
+
+	for (long i = 0; i < nchecks; ++i) {
+		size_t len = 0;
+		int npieces = _xorshift(&x) % 6;
+		for (int j = 0; j < npieces; ++j) len = _fuzz_piece(buf, len, &x);
+		buf[len] = 0;
+
+		struct timer_line got, want;
+		enum timer_parse_error got_err = timer_parse_line(buf, &got);
+		enum timer_parse_error want_err = _ref_parse_line(buf, &want);
+
+		bool same = got_err == want_err;
+		if (same && !got_err) {
+			same = got.has_time == want.has_time && got.has_real_time == want.has_real_time &&
+				got.time == want.time && got.real_time == want.real_time && got.ev == want.ev;
+		}
+
+		if (!same) {
+			fprintf(stderr, "Mismatch for '%s': error %d, expected %d\n", buf, got_err, want_err);
+			return 1;
+		}
+
+		if (!got_err) ++nvalid;
+	}
+
+	printf("checked:          %ld lines (%ld valid), all identical\n", nchecks, nvalid);
+
+	// What a splitter sends: mostly times, some with the real time, and
+	// the occasional event
+	static char corpus[NCORPUS][MAX_LINE + 1];
+	uint64_t us = 0, real_us = 0;
+	for (int i = 0; i < NCORPUS; ++i) {
+		us += 15000 + _xorshift(&x) % 2000;
+		real_us += 16667;
+		if (i % 64 == 63) {
+			sprintf(corpus[i], "%"PRIu64" SPLIT", us);
+		} else if (i % 2) {
+			sprintf(corpus[i], "%"PRIu64" %"PRIu64, us, real_us);
+		} else {
+			sprintf(corpus[i], "%"PRIu64, us);
+		}
+	}
+
+	volatile uint64_t sink = 0;
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < nlines; ++i) {
+		long t;
+		enum timer_event ev;
+		_strtol_parse_line(corpus[i % NCORPUS], &t, &ev);
+		sink += t + ev;
+	}
+	double ns = _elapsed_ns(&start);
+	printf("strtol:           %.1f ns/line (%.1f M lines/s)\n", ns / nlines, nlines / ns * 1e3);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < nlines; ++i) {
+		struct timer_line line;
+		timer_parse_line(corpus[i % NCORPUS], &line);
+		sink += line.time + line.ev;
+	}
+	ns = _elapsed_ns(&start);
+	printf("timer_parse_line: %.1f ns/line (%.1f M lines/s)\n", ns / nlines, nlines / ns * 1e3);
+
+	(void)sink;
+
+	return 0;
+}
@@ -0,0 +1,340 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// A load test for adrift-server: runs it with a directory for each of
+// many runners, streams a time to every runner at a splitter's rate for a
+// while, with a split each second, and reads the server's CPU time from
+// /proc. Then it sends everyone a last time and waits for the standings
+// to show all of them. Exits 1 if the server used more than its budget of
+// one core, or lost any times
+
+#define DEFAULT_RUNNERS 128
+#define DEFAULT_RATE_HZ 66
+#define DEFAULT_SECS 10
+#define DEFAULT_BUDGET_PCT 50
+#define STARTUP_TIMEOUT_MS 5000
+#define SETTLE_TIMEOUT_MS 5000
+
+static char _base[] = "/tmp/adrift_server_load.XXXXXX";
+
+static uint64_t _now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _sleep_until_ns(uint64_t t) {
+	struct timespec ts = { .tv_sec = t / 1000000000, .tv_nsec = t % 1000000000 };
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static bool _write_file(const char *path, const char *contents) {
+	FILE *f = fopen(path, "w");
+	if (!f) return false;
+	fputs(contents, f);
+	return fclose(f) == 0;
+}
+
+// A runner's directory, with enough splits to never finish
+static bool _make_runner(int i, int nsplits) {
+	char path[128], buf[64];
+	snprintf(path, sizeof path, "%s/r%03d", _base, i);
+	if (mkdir(path, 0755) == -1) return false;
+
+	snprintf(path, sizeof path, "%s/r%03d/config", _base, i);
+	snprintf(buf, sizeof buf, "runner r%03d\n", i);
+	if (!_write_file(path, buf)) return false;
+
+	// No PB or golds yet
+	static const char *const files[] = { "splits", "pb", "golds" };
+	for (size_t k = 0; k < sizeof files / sizeof files[0]; ++k) {
+		snprintf(path, sizeof path, "%s/r%03d/%s", _base, i, files[k]);
+		FILE *f = fopen(path, "w");
+		if (!f) return false;
+		for (int j = 0; j < nsplits; ++j) {
+			if (k == 0) {
+				fprintf(f, "Split %d\n", j + 1);
+			} else {
+				fputs("-\n", f);
+			}
+		}
+		if (fclose(f)) return false;
+	}
+
+	return true;
+}
+
+// Remove the files in a directory and then the directory
+static void _remove_dir(const char *path) {
+	DIR *d = opendir(path);
+	if (d) {
+		struct dirent *ent;
+		while ((ent = readdir(d))) {
+			if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, "..")) unlinkat(dirfd(d), ent->d_name, 0);
+		}
+		closedir(d);
+	}
+	rmdir(path);
+}
+
+static void _cleanup(int nrunners) {
+	char path[128];
+	for (int i = 0; i < nrunners; ++i) {
+		snprintf(path, sizeof path, "%s/r%03d", _base, i);
+		_remove_dir(path);
+	}
+	_remove_dir(_base);
+}
+
+// Connect to a socket the server may not have made yet
+static int _connect(const char *path) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	snprintf(addr.sun_path, sizeof addr.sun_path, "%s", path);
+
+	uint64_t deadline = _now_ns() + STARTUP_TIMEOUT_MS * 1000000ull;
+	while (_now_ns() < deadline) {
+		int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd == -1) return -1;
+		if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == 0) return fd;
+		close(fd);
+		_sleep_until_ns(_now_ns() + 10000000);
+	}
+
+	return -1;
+}
+
+// utime plus stime of a process, in seconds
+static double _cpu_secs(pid_t pid) {
+	char path[64];
+	snprintf(path, sizeof path, "/proc/%ld/stat", (long)pid);
+	FILE *f = fopen(path, "r");
+	if (!f) return -1;
+
+	// The command name may contain spaces, so skip to its closing paren
+	char buf[1024];
+	size_t n = fread(buf, 1, sizeof buf - 1, f);
+	fclose(f);
+	buf[n] = 0;
+
+	char *p = strrchr(buf, ')');
+	unsigned long utime, stime;
+	if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+		return -1;
+	}
+
+	return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static bool _send_line(int fd, const char *line) {
+	size_t len = strlen(line);
+	while (len) {
+		ssize_t n = write(fd, line, len);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		line += n;
+		len -= n;
+	}
+	return true;
+}
+
+// Read the standings feed until a whole update shows every runner's time
+// as the last one sent, which is want + their index
+static bool _settle(int feed, int nrunners, uint64_t want) {
+	static char buf[1 << 16];
+	size_t len = 0;
+	int matched = 0;
+	uint64_t deadline = _now_ns() + SETTLE_TIMEOUT_MS * 1000000ull;
+
+	while (true) {
+		int64_t left = (int64_t)(deadline - _now_ns()) / 1000000;
+		struct pollfd pfd = { .fd = feed, .events = POLLIN };
+		if (left <= 0 || poll(&pfd, 1, left) <= 0) return false;
+
+		ssize_t n = read(feed, buf + len, sizeof buf - 1 - len);
+		if (n == -1 && errno == EAGAIN) continue;
+		if (n <= 0) return false;
+		len += n;
+		buf[len] = 0;
+
+		char *start = buf, *nl;
+		while ((nl = strchr(start, '\n'))) {
+			*nl = 0;
+			if (!*start) {
+				if (matched == nrunners) return true;
+				matched = 0;
+			} else {
+				// place, status, splits, time, delta, best possible, name
+				uint64_t t;
+				int idx;
+				char *name = strrchr(start, '\t');
+				if (sscanf(start, "%*s %*s %*s %"SCNu64, &t) == 1 && name && sscanf(name + 1, "r%d", &idx) == 1 && t == want + idx) {
+					++matched;
+				}
+			}
+			start = nl + 1;
+		}
+
+		len -= start - buf;
+		memmove(buf, start, len);
+	}
+}
+
+int main(int argc, char **argv) {
+	int nrunners = DEFAULT_RUNNERS, rate = DEFAULT_RATE_HZ, secs = DEFAULT_SECS, budget = DEFAULT_BUDGET_PCT;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "r:z:t:b:h")) != -1) {
+		switch (opt) {
+		case 'r': nrunners = atoi(optarg); break;
+		case 'z': rate = atoi(optarg); break;
+		case 't': secs = atoi(optarg); break;
+		case 'b': budget = atoi(optarg); break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (argc - optind > 1 || nrunners < 1 || nrunners > 999 || rate < 1 || secs < 1) goto usage;
+	const char *server = optind < argc ? argv[optind] : "./adrift-server";
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (!mkdtemp(_base)) {
+		fputs("Failed to create a directory for the runners\n", stderr);
+		return 1;
+	}
+
+	for (int i = 0; i < nrunners; ++i) {
+		if (!_make_runner(i, secs + 2)) {
+			fputs("Failed to create a runner\n", stderr);
+			_cleanup(i + 1);
+			return 1;
+		}
+	}
+
+	char feed_path[128];
+	snprintf(feed_path, sizeof feed_path, "%s/standings.sock", _base);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		char **args = calloc(nrunners + 4, sizeof args[0]);
+		args[0] = (char *)server;
+		args[1] = "-s";
+		args[2] = feed_path;
+		for (int i = 0; i < nrunners; ++i) {
+			args[3 + i] = malloc(128);
+			snprintf(args[3 + i], 128, "%s/r%03d", _base, i);
+		}
+		execv(server, args);
+		fprintf(stderr, "Failed to run %s\n", server);
+		_exit(1);
+	}
+
+	bool ok = pid != -1;
+	int *fds = malloc(nrunners * sizeof fds[0]);
+	int feed = ok ? _connect(feed_path) : -1;
+	if (feed == -1) ok = false;
+
+	for (int i = 0; i < nrunners && ok; ++i) {
+		char path[128];
+		snprintf(path, sizeof path, "%s/r%03d/timer.sock", _base, i);
+		fds[i] = _connect(path);
+		if (fds[i] == -1) ok = false;
+	}
+
+	if (!ok) {
+		fprintf(stderr, "Failed to start %s\n", server);
+		goto out;
+	}
+
+	// The feed is emptied without waiting while the times are streamed
+	fcntl(feed, F_SETFL, fcntl(feed, F_GETFL) | O_NONBLOCK);
+
+	for (int i = 0; i < nrunners; ++i) _send_line(fds[i], "0 BEGIN\n");
+
+	uint64_t tick_ns = 1000000000 / rate, tick_us = tick_ns / 1000;
+	long nticks = (long)secs * rate;
+	uint64_t late_ns = 0;
+	char line[64];
+
+	double cpu_start = _cpu_secs(pid);
+	uint64_t start = _now_ns();
+
+	for (long tick = 1; tick <= nticks && ok; ++tick) {
+		uint64_t due = start + tick * tick_ns;
+		_sleep_until_ns(due);
+
+		// Everyone splits once a second, in turn
+		for (int i = 0; i < nrunners && ok; ++i) {
+			uint64_t us = tick * tick_us + i;
+			bool split = tick % rate == i * rate / nrunners;
+			snprintf(line, sizeof line, split ? "%"PRIu64" SPLIT\n" : "%"PRIu64"\n", us);
+			ok = _send_line(fds[i], line);
+		}
+
+		uint64_t late = _now_ns() - due;
+		if (late > late_ns) late_ns = late;
+
+		// Standings the server couldn't send would just be skipped, but
+		// this is what a real feed would do
+		char discard[1 << 16];
+		while (read(feed, discard, sizeof discard) > 0);
+	}
+
+	double wall = (_now_ns() - start) / 1e9;
+	double cpu = _cpu_secs(pid) - cpu_start;
+
+	if (!ok) {
+		fputs("Lost the connection to the server\n", stderr);
+		goto out;
+	}
+
+	// One last time for everyone, which the standings must all show
+	uint64_t last = (nticks + 1) * tick_us;
+	for (int i = 0; i < nrunners; ++i) {
+		snprintf(line, sizeof line, "%"PRIu64"\n", last + i);
+		_send_line(fds[i], line);
+	}
+
+	bool settled = _settle(feed, nrunners, last);
+	double pct = cpu / wall * 100;
+
+	printf("runners:      %d at %d Hz for %d s (%.0f lines/s)\n", nrunners, rate, secs, nrunners * rate * (double)secs / wall);
+	printf("server cpu:   %.2f s in %.2f s (%.1f%% of a core)\n", cpu, wall, pct);
+	printf("latest tick:  %.2f ms\n", late_ns / 1e6);
+	printf("standings:    %s\n", settled ? "all times arrived" : "times missing");
+
+	if (!settled) ok = false;
+	if (cpu < 0 || pct > budget) {
+		fprintf(stderr, "Server used %.1f%% of a core, over the budget of %d%%\n", pct, budget);
+		ok = false;
+	}
+
+out:
+	if (pid > 0) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+	_cleanup(nrunners);
+
+	return !ok;
+
+usage:
+	fprintf(stderr, "Usage: %s [-r runners] [-z rate Hz] [-t seconds] [-b budget %% of a core] [adrift-server]\n", argv[0]);
+	return 1;
+}
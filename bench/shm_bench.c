@@ -0,0 +1,272 @@
+#include "export.h"
+#include "adrift_shm.h"
+#include "profile.h"
+#include "timer.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+// Measures how long the timer takes to apply a line of rift data and
+// publish it in shared memory, with 0 to 16 reader threads polling the
+// segment the way shm_reader does. Readers never make adrift wait, so the
+// latency shouldn't grow with their number. Exits 1 if the 99th
+// percentile is ever over budget, or a reader sees a torn state
+
+#define DEFAULT_UPDATES 1000
+#define DEFAULT_INTERVAL_US 2000
+#define DEFAULT_POLL_US 1000
+#define DEFAULT_BUDGET_US 1000
+#define NSPLITS 48
+#define SPLIT_EVERY 60
+
+static const int _reader_counts[] = { 0, 1, 2, 4, 8, 16 };
+
+static char _shm_name[64];
+static long _poll_us = DEFAULT_POLL_US;
+static atomic_bool _stop;
+
+struct reader {
+	thrd_t thrd;
+	long reads;
+	long retries;
+	bool torn;
+};
+
+static uint64_t _now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _sleep_ns(uint64_t ns) {
+	struct timespec ts = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+// A reader with its own read-only mapping. The table doesn't grow while
+// the benchmark runs, so it's only mapped once
+static int _reader_main(void *u) {
+	struct reader *r = u;
+
+	int fd = shm_open(_shm_name, O_RDONLY, 0);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		r->torn = true;
+		return 1;
+	}
+
+	const struct adrift_shm *shm = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		r->torn = true;
+		return 1;
+	}
+
+	struct adrift_shm_state state;
+	struct adrift_shm_split splits[NSPLITS];
+
+	while (!atomic_load_explicit(&_stop, memory_order_relaxed)) {
+		while (true) {
+			uint32_t seq = atomic_load_explicit(&shm->seq, memory_order_acquire);
+			if (!(seq & 1)) {
+				state = shm->state;
+				if (state.nsplits <= NSPLITS) memcpy(splits, shm->splits, state.nsplits * sizeof splits[0]);
+
+				atomic_thread_fence(memory_order_acquire);
+				if (atomic_load_explicit(&shm->seq, memory_order_relaxed) == seq) break;
+			}
+			++r->retries;
+		}
+
+		// The split time is how long the active split has taken, which is
+		// never more than the timer, so a snapshot with it more is torn
+		if (state.nsplits != NSPLITS || (state.active_split != -1 && state.split_time > state.timer)) {
+			r->torn = true;
+		}
+
+		++r->reads;
+		if (_poll_us) _sleep_ns(_poll_us * 1000);
+	}
+
+	munmap((void *)shm, st.st_size);
+	return 0;
+}
+
+static int _cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+// A profile of NSPLITS splits in groups of 8 with times, in a new
+// directory
+static char *_make_profile(void) {
+	static char dir[] = "/tmp/adrift_shm_bench.XXXXXX";
+	if (!mkdtemp(dir)) return NULL;
+
+	char path[sizeof dir + 16];
+	snprintf(path, sizeof path, "%s/splits", dir);
+	FILE *f = fopen(path, "w");
+	if (!f) return NULL;
+	for (int i = 0; i < NSPLITS; ++i) {
+		if (i % 8 == 0) fprintf(f, "Chapter %d\n", i / 8 + 1);
+		fprintf(f, "\tMap %d\n", i + 1);
+	}
+	fclose(f);
+
+	// A PB a second a split, and golds a tenth faster, so there are
+	// deltas to publish
+	snprintf(path, sizeof path, "%s/pb", dir);
+	f = fopen(path, "w");
+	if (!f) return NULL;
+	for (int i = 0; i < NSPLITS; ++i) fprintf(f, "%d\n", (i + 1) * 1000000);
+	fclose(f);
+
+	snprintf(path, sizeof path, "%s/golds", dir);
+	f = fopen(path, "w");
+	if (!f) return NULL;
+	for (int i = 0; i < NSPLITS; ++i) fprintf(f, "%d\n", 900000);
+	fclose(f);
+
+	snprintf(path, sizeof path, "%s/config", dir);
+	f = fopen(path, "w");
+	if (!f) return NULL;
+	fclose(f);
+
+	return dir;
+}
+
+static void _remove_profile(const char *dir) {
+	DIR *d = opendir(dir);
+	if (d) {
+		struct dirent *ent;
+		while ((ent = readdir(d))) {
+			if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, "..")) unlinkat(dirfd(d), ent->d_name, 0);
+		}
+		closedir(d);
+	}
+	rmdir(dir);
+}
+
+int main(int argc, char **argv) {
+	long nupdates = DEFAULT_UPDATES, interval_us = DEFAULT_INTERVAL_US, budget_us = DEFAULT_BUDGET_US;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:i:p:b:h")) != -1) {
+		switch (opt) {
+		case 'n': nupdates = atol(optarg); break;
+		case 'i': interval_us = atol(optarg); break;
+		case 'p': _poll_us = atol(optarg); break;
+		case 'b': budget_us = atol(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-n updates] [-i update interval us] [-p reader poll us, 0 to spin] [-b p99 budget us]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (nupdates < 1) nupdates = 1;
+
+	char *dir = _make_profile();
+	if (!dir) {
+		fputs("Failed to create a profile\n", stderr);
+		return 1;
+	}
+
+	struct profile prof;
+	if (!profile_open(&prof, dir) || !profile_load(&prof)) {
+		_remove_profile(dir);
+		return 1;
+	}
+
+	snprintf(_shm_name, sizeof _shm_name, "/adrift_shm_bench.%ld", (long)getpid());
+	config_put(prof.cfg, "shm_name", strlen("shm_name"), _shm_name);
+
+	struct state s = {
+		.active_split = -1,
+		.cfg = prof.cfg,
+	};
+	profile_activate(&s, &prof);
+
+	if (!export_start(&s)) {
+		_remove_profile(dir);
+		return 1;
+	}
+
+	uint64_t *lat = malloc(nupdates * sizeof lat[0]);
+	struct reader readers[16];
+	bool ok = true;
+
+	printf("readers       p50 us    p99 us    max us   reads/s  retries\n");
+
+	for (size_t c = 0; c < sizeof _reader_counts / sizeof _reader_counts[0]; ++c) {
+		int nreaders = _reader_counts[c];
+
+		timer_parse(&s, "0 BEGIN");
+		export_update(&s);
+
+		atomic_store(&_stop, false);
+		for (int i = 0; i < nreaders; ++i) {
+			readers[i] = (struct reader){ 0 };
+			thrd_create(&readers[i].thrd, _reader_main, &readers[i]);
+		}
+
+		uint64_t start = _now_ns();
+		char line[64];
+
+		for (long i = 0; i < nupdates; ++i) {
+			uint64_t us = (i + 1) * 16667;
+			if ((i + 1) % SPLIT_EVERY == 0) {
+				snprintf(line, sizeof line, "%"PRIu64" SPLIT", us);
+			} else {
+				snprintf(line, sizeof line, "%"PRIu64, us);
+			}
+
+			uint64_t t0 = _now_ns();
+			timer_parse(&s, line);
+			export_update(&s);
+			lat[i] = _now_ns() - t0;
+
+			_sleep_ns(interval_us * 1000);
+		}
+
+		double secs = (_now_ns() - start) / 1e9;
+
+		atomic_store(&_stop, true);
+		long reads = 0, retries = 0;
+		for (int i = 0; i < nreaders; ++i) {
+			thrd_join(readers[i].thrd, NULL);
+			reads += readers[i].reads;
+			retries += readers[i].retries;
+			if (readers[i].torn) {
+				fprintf(stderr, "Reader %d of %d saw a torn state\n", i, nreaders);
+				ok = false;
+			}
+		}
+
+		timer_parse(&s, "0 RESET");
+
+		qsort(lat, nupdates, sizeof lat[0], _cmp_u64);
+		double p50 = lat[nupdates / 2] / 1e3, p99 = lat[nupdates * 99 / 100] / 1e3, max = lat[nupdates - 1] / 1e3;
+		printf("%7d %12.2f %9.2f %9.2f %9.0f %8ld\n", nreaders, p50, p99, max, reads / secs, retries);
+
+		if (p99 > budget_us) {
+			fprintf(stderr, "p99 with %d readers is over the budget of %ld us\n", nreaders, budget_us);
+			ok = false;
+		}
+	}
+
+	free(lat);
+	export_stop();
+	_remove_profile(dir);
+
+	return !ok;
+}
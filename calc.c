@@ -36,8 +36,10 @@ static uint64_t _bpt(struct state *s, struct split *splits, size_t nsplits) {
 			best = splits[i].split.times.best;
 			if (s->split_time > best) best = s->split_time;
 		} else if (splits[i].split.times.cur != UINT64_MAX) {
-			uint64_t prev = splits[i].split.id == 0 ? 0 : get_split_by_id(s, splits[i].split.id - 1)->split.times.cur;
-			best = splits[i].split.times.cur - prev;
+			best = splits[i].split.times.cur - get_prev_cur(s, splits[i].split.id);
+		} else if (s->active_split != -1 && splits[i].split.id < s->active_split) {
+			// Skipped; its time is counted in the next timed split
+			best = 0;
 		} else {
 			best = splits[i].split.times.best;
 		}
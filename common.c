@@ -1,5 +1,11 @@
 #include "common.h"
+#include <stdatomic.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define STATS_SUBSYS STATS_TIMER
+#include "stats.h"
 
 static struct split *_get_split_by_id(struct split *splits, size_t nsplits, unsigned id) {
 	for (size_t i = 0; i < nsplits; ++i) {
@@ -14,7 +20,24 @@ static struct split *_get_split_by_id(struct split *splits, size_t nsplits, unsi
 	return NULL;
 }
 
+struct view get_view(struct state *s) {
+	return (struct view){
+		.static_gen = s->static_gen,
+		.active_split = s->active_split,
+		.timer = s->timer,
+		.split_time = s->split_time,
+	};
+}
+
+bool view_eq(const struct view *a, const struct view *b) {
+	return a->static_gen == b->static_gen && a->active_split == b->active_split && a->timer == b->timer && a->split_time == b->split_time;
+}
+
 struct split *get_split_by_id(struct state *s, unsigned id) {
+	if (s->by_id) {
+		return id < s->nids ? s->by_id[id] : NULL;
+	}
+
 	return _get_split_by_id(s->splits, s->nsplits, id);
 }
 
@@ -44,15 +67,194 @@ struct times get_split_times(struct split *sp) {
 	return sp->split.times;
 }
 
+// The cumulative time of the last split before the given one which has a
+// time in the current run, skipping over skipped splits, or 0 if none do
+uint64_t get_prev_cur(struct state *s, int id) {
+	for (int i = id - 1; i >= 0; --i) {
+		uint64_t cur = get_split_by_id(s, i)->split.times.cur;
+		if (cur != UINT64_MAX) return cur;
+	}
+
+	return 0;
+}
+
 uint64_t get_comparison(struct state *s, struct times t) {
 	return t.pb;
 }
 
+// Write n in decimal, zero-padded to width digits, returning the end
+static char *_put_uint(char *p, uint64_t n, int width) {
+	char tmp[20];
+	int len = 0;
+	do {
+		tmp[len++] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	while (len < width) tmp[len++] = '0';
+	while (len) *p++ = tmp[--len];
+	return p;
+}
+
+static const uint64_t _pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+const char *format_time(char *buf, uint64_t total, char prefix, int prec) {
+	if (total == UINT64_MAX) return strcpy(buf, "-");
+
+	if (prec < 0) prec = 0;
+	if (prec > 6) prec = 6;
+
+	uint64_t frac = prec ? total % 1000000 / _pow10[6 - prec] : 0;
+
+	total /= 1000000;
+	uint64_t secs = total % 60;
+	total /= 60;
+	uint64_t mins = total % 60;
+	total /= 60;
+	uint64_t hrs = total;
+
+	char *p = buf;
+	if (prefix) *p++ = prefix;
+
+	if (hrs) {
+		p = _put_uint(p, hrs, 0);
+		*p++ = ':';
+		p = _put_uint(p, mins, 2);
+		*p++ = ':';
+		p = _put_uint(p, secs, 2);
+	} else if (mins) {
+		p = _put_uint(p, mins, 0);
+		*p++ = ':';
+		p = _put_uint(p, secs, 2);
+	} else {
+		p = _put_uint(p, secs, 0);
+	}
+
+	*p++ = '.';
+	p = _put_uint(p, frac, prec);
+	*p = 0;
+
+	return buf;
+}
+
+const char *format_time_cell(struct time_cell *c, uint64_t total, char prefix, int prec) {
+	if (c->prec != prec || c->prefix != prefix || c->val != total) {
+		format_time(c->str, total, prefix, prec);
+		c->val = total;
+		c->prefix = prefix;
+		c->prec = prec;
+	}
+
+	return c->str;
+}
+
 void free_splits(struct split *splits, size_t nsplits) {
 	for (size_t i = 0; i < nsplits; ++i) {
 		free(splits[i].name);
 		if (splits[i].is_group) {
 			free_splits(splits[i].group.splits, splits[i].group.nsplits);
+			free(splits[i].group.splits);
 		}
 	}
 }
+
+void free_widgets(struct widget *widgets, size_t nwidgets) {
+	for (size_t i = 0; i < nwidgets; ++i) {
+		free(widgets[i].text);
+	}
+	free(widgets);
+}
+
+static void _count_splits(struct split *splits, size_t nsplits, size_t *nrows, size_t *nids) {
+	for (size_t i = 0; i < nsplits; ++i) {
+		++*nrows;
+		if (splits[i].is_group) {
+			_count_splits(splits[i].group.splits, splits[i].group.nsplits, nrows, nids);
+		} else {
+			++*nids;
+		}
+	}
+}
+
+static void _layout_splits(struct state *s, struct split *splits, size_t nsplits, int depth) {
+	for (size_t i = 0; i < nsplits; ++i) {
+		if (!splits[i].is_group && splits[i].split.id == s->active_split) {
+			s->active_row = s->nrows;
+		}
+
+		s->rows[s->nrows++] = (struct split_row){ &splits[i], depth };
+
+		if (splits[i].is_group && splits[i].group.expanded) {
+			_layout_splits(s, splits[i].group.splits, splits[i].group.nsplits, depth + 1);
+		}
+	}
+}
+
+static void _index_splits(struct state *s, struct split *splits, size_t nsplits) {
+	for (size_t i = 0; i < nsplits; ++i) {
+		if (splits[i].is_group) {
+			_index_splits(s, splits[i].group.splits, splits[i].group.nsplits);
+		} else {
+			s->by_id[splits[i].split.id] = &splits[i];
+		}
+	}
+}
+
+// Build the layout index, so that drawing and looking up splits don't
+// have to walk the whole tree
+void layout_splits(struct state *s) {
+	if (!s->rows) {
+		size_t nrows = 0, nids = 0;
+		_count_splits(s->splits, s->nsplits, &nrows, &nids);
+
+		// Enough for every group to be expanded
+		s->rows = malloc(nrows * sizeof s->rows[0]);
+		s->by_id = malloc(nids * sizeof s->by_id[0]);
+		s->nids = nids;
+		_index_splits(s, s->splits, s->nsplits);
+	}
+
+	s->nrows = 0;
+	s->active_row = SIZE_MAX;
+	_layout_splits(s, s->splits, s->nsplits, 0);
+	if (s->active_row == SIZE_MAX) s->active_row = s->nrows;
+}
+
+void free_layout(struct state *s) {
+	free(s->rows);
+	free(s->by_id);
+	s->rows = NULL;
+	s->by_id = NULL;
+	s->nrows = s->nids = 0;
+}
+
+uint64_t get_mono_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t _startup_us;
+static bool _startup_report;
+static atomic_bool _startup_marked[STARTUP_NMARKS];
+
+void startup_begin(void) {
+	_startup_us = get_mono_us();
+}
+
+void startup_report(bool report) {
+	_startup_report = report;
+}
+
+void startup_mark(enum startup_mark m) {
+	static const char *const names[] = {
+		[STARTUP_FIRST_FRAME] = "first frame",
+		[STARTUP_SPLITTER_ATTACHED] = "splitter attached",
+	};
+
+	if (atomic_exchange(&_startup_marked[m], true)) return;
+
+	if (_startup_report) {
+		uint64_t us = get_mono_us() - _startup_us;
+		fprintf(stderr, "Startup: %s after %.1fms\n", names[m], us / 1000.0);
+	}
+}
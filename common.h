@@ -1,13 +1,16 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#ifndef ADRIFT_HEADLESS
 #include <vtk.h>
+#endif
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <threads.h>
 #include <time.h>
 #include "config.h"
+#include "store.h"
 
 enum widget_type {
 	WIDGET_GAME_NAME,
@@ -17,6 +20,17 @@ enum widget_type {
 	WIDGET_SPLITS,
 	WIDGET_SUM_OF_BEST,
 	WIDGET_BEST_POSSIBLE_TIME,
+	WIDGET_SPACER,
+	WIDGET_LABEL,
+	WIDGET_PB_CHANCE,
+	WIDGET_PREDICTED_FINISH,
+	WIDGET_TIME_SAVE,
+};
+
+struct widget {
+	enum widget_type type;
+	int height; // Spacer only
+	char *text; // Label only
 };
 
 struct times {
@@ -29,12 +43,34 @@ struct times {
 	// Per-split
 	uint64_t best;
 	bool golded_this_run;
+	// The gold from before this run, so that a split can be undone
+	uint64_t prev_best;
 };
 
+// Enough for any time format_time produces
+#define TIME_BUF_SIZE 32
+
+// A formatted time, kept so that it's only reformatted when it changes
+struct time_cell {
+	uint64_t val;
+	char prefix;
+	signed char prec; // -1 if empty
+	char str[TIME_BUF_SIZE];
+};
+
+// Format a time in microseconds into buf, which must be TIME_BUF_SIZE
+// bytes, with prec digits after the decimal point. Returns buf
+const char *format_time(char *buf, uint64_t total, char prefix, int prec);
+// Format a time into a cell, unless it already holds the same time
+const char *format_time_cell(struct time_cell *c, uint64_t total, char prefix, int prec);
+
 struct split {
 	char *name;
 	bool is_group;
 
+	// The delta and time as last drawn
+	struct time_cell fmt_delta, fmt_time;
+
 	union {
 		struct {
 			size_t nsplits;
@@ -49,34 +85,141 @@ struct split {
 	};
 };
 
+// A row of the split list as displayed
+struct split_row {
+	struct split *split;
+	int depth;
+};
+
+// A directory with its own splits, times and config. The state holds
+// those of the active profile, and the rest are kept here fully loaded,
+// so that switching is just swapping them over
+struct profile {
+	char *path;
+	int dirfd;
+	int journal; // -1 if it has none
+
+	// Only the game and category are taken from a profile's config; the
+	// rest of the settings are the first profile's
+	struct cfgdict *cfg;
+	const char *game_name;
+	const char *category_name;
+
+	size_t nsplits;
+	struct split *splits;
+
+	size_t nrows;
+	struct split_row *rows;
+	size_t active_row;
+	size_t nids;
+	struct split **by_id;
+
+	struct store pb_store;
+	struct store golds_store;
+};
+
 struct state {
+#ifndef ADRIFT_HEADLESS
 	vtk_window win;
 	cairo_t *cr;
+#endif
+
+	// Held while drawing, and while applying input to the timer, as input
+	// may come from several threads
+	mtx_t lock;
 
 	const char *game_name;
 	const char *category_name;
 
 	size_t nwidgets;
-	enum widget_type *widgets;
+	struct widget *widgets;
 
 	size_t nsplits;
 	struct split *splits;
 
+	// The layout index, rebuilt by layout_splits whenever groups are
+	// expanded or collapsed: the visible rows in order, the row of the
+	// active split (nrows if there is none), and every split by id
+	size_t nrows;
+	struct split_row *rows;
+	size_t active_row;
+	size_t nids;
+	struct split **by_id;
+
+	// The pb and golds, as stored on disk
+	struct store pb_store;
+	struct store golds_store;
+
+	// Incremented whenever anything changes which is drawn other than the
+	// timers and the active split, so cached drawing can be redone
+	unsigned static_gen;
+
 	int active_split;
 
+	// As displayed, which is interpolated between updates from the
+	// splitter
 	uint64_t timer;
 	uint64_t split_time;
 
+	// The last time received, and CLOCK_MONOTONIC in microseconds when it
+	// was received
+	uint64_t anchor_timer;
+	uint64_t anchor_mono;
+	// The last real time received along with the game time, if any
+	uint64_t anchor_real;
+	// Set when the game time has stopped, so it isn't interpolated
+	bool paused;
+	// Set when a run has been restored from the journal, until the first
+	// event
+	bool resumed;
+
 	time_t run_started;
 
+	// Every profile, and the index of the active one
+	size_t nprofiles;
+	struct profile *profiles;
+	size_t profile;
+
 	struct cfgdict *cfg;
 };
 
+// What's drawn of the timer, to tell whether the window needs redrawing.
+// Anything else that's drawn changes static_gen
+struct view {
+	unsigned static_gen;
+	int active_split;
+	uint64_t timer;
+	uint64_t split_time;
+};
+
+struct view get_view(struct state *s);
+bool view_eq(const struct view *a, const struct view *b);
+
 struct split *get_split_by_id(struct state *s, unsigned id);
 int get_split_id(struct split *sp);
 struct split *get_final_split(struct state *s);
 struct times get_split_times(struct split *sp);
+uint64_t get_prev_cur(struct state *s, int id);
 uint64_t get_comparison(struct state *s, struct times t);
 void free_splits(struct split *splits, size_t nsplits);
+void free_widgets(struct widget *widgets, size_t nwidgets);
+void layout_splits(struct state *s);
+void free_layout(struct state *s);
+
+// CLOCK_MONOTONIC in microseconds
+uint64_t get_mono_us(void);
+
+// Points during startup, each reported with how long after startup_begin
+// it first happened, if reporting is on
+enum startup_mark {
+	STARTUP_FIRST_FRAME,
+	STARTUP_SPLITTER_ATTACHED, // The splitter first sent anything
+	STARTUP_NMARKS,
+};
+
+void startup_begin(void);
+void startup_report(bool report);
+// May be called from any thread, and any number of times
+void startup_mark(enum startup_mark m);
 
 #endif
@@ -1,11 +1,52 @@
 #define VDICT_IMPL
+#define STATS_SUBSYS STATS_CONFIG
 
+// First, so that the dictionary's own allocations are counted
+#include "stats.h"
 #include "config.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <ctype.h>
 
+int config_put(struct cfgdict *cfg, const char *k, size_t klen, const char *v) {
+	char *key = strndup(k, klen);
+	char *val = strdup(v);
+	if (!key || !val) {
+		free(key);
+		free(val);
+		return -1;
+	}
+
+	// Replace the value of a key which is already set, keeping its key
+	uint32_t i = _cfgdict_index(cfg, key, _cfgdict_hash(cfg, key));
+	if (_cfgdict_exists(cfg, i)) {
+		struct _cfgdict_entry *ent = _cfgdict_entry(cfg, i);
+		free(ent->v);
+		ent->v = val;
+		free(key);
+		return 1;
+	}
+
+	int ret = cfgdict_put(cfg, key, val);
+	if (ret == -1) {
+		free(key);
+		free(val);
+	}
+
+	return ret;
+}
+
+void config_free(struct cfgdict *cfg) {
+	for (uint32_t i = 0; i < cfg->n_entry; ++i) {
+		if (cfg->ent[i].removed) continue;
+		free(cfg->ent[i].k);
+		free(cfg->ent[i].v);
+	}
+
+	cfgdict_free(cfg);
+}
+
 bool config_get_color(struct cfgdict *cfg, const char *k, float *r, float *g, float *b, float *a) {
 	char *v;
 	if (!cfgdict_get(cfg, (char *)k, &v)) {
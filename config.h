@@ -2,6 +2,7 @@
 #define CONFIG_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #define VDICT_NAME cfgdict
 #define VDICT_KEY char *
@@ -10,6 +11,12 @@
 #define VDICT_EQUAL vdict_eq_string
 #include "vdict.h"
 
+// Set a key, klen bytes of k, to a copy of v. Returns 1 if the key was
+// already set, 0 if it wasn't, and -1 if out of memory
+int config_put(struct cfgdict *cfg, const char *k, size_t klen, const char *v);
+// Free a dictionary along with the keys and values put in it
+void config_free(struct cfgdict *cfg);
+
 bool config_get_color(struct cfgdict *cfg, const char *k, float *r, float *g, float *b, float *a);
 long config_get_int(struct cfgdict *cfg, const char *k, long def);
 const char *config_get_str(struct cfgdict *cfg, const char *k, const char *def);
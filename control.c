@@ -0,0 +1,127 @@
+#include "control.h"
+#include "profile.h"
+#include "timer.h"
+#include <string.h>
+#include <sys/socket.h>
+
+// The largest message adrift sends: a delta with every field set
+#define MAX_MSG_SIZE (sizeof (struct control_hdr) + sizeof (uint32_t) + 4 * sizeof (uint64_t))
+
+static struct control_state _get_state(struct state *s) {
+	return (struct control_state){
+		.active_split = s->active_split,
+		.timer = s->timer,
+		.split_time = s->split_time,
+		.profile = s->profile,
+	};
+}
+
+// Send a message without blocking. A client which isn't keeping up loses
+// the message, and subscribers are resynced once there's space again
+static void _send(struct control_conn *c, uint8_t type, const void *payload, size_t len) {
+	uint8_t buf[MAX_MSG_SIZE];
+	struct control_hdr hdr = { .type = type, .len = len };
+	memcpy(buf, &hdr, sizeof hdr);
+	memcpy(buf + sizeof hdr, payload, len);
+
+	if (send(c->fd, buf, sizeof hdr + len, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)(sizeof hdr + len)) {
+		c->resync = true;
+	}
+}
+
+static void _send_state(struct state *s, struct control_conn *c) {
+	struct control_state st = _get_state(s);
+	c->resync = false;
+	_send(c, CONTROL_STATE, &st, sizeof st);
+	c->last = st;
+}
+
+long control_handle(struct state *s, struct control_conn *c, const uint8_t *buf, size_t len) {
+	size_t off = 0;
+
+	while (len - off >= sizeof (struct control_hdr)) {
+		struct control_hdr hdr;
+		memcpy(&hdr, buf + off, sizeof hdr);
+
+		// Skip over any payload a command doesn't use, so that newer
+		// clients can add fields
+		if (len - off - sizeof hdr < hdr.len) break;
+		const uint8_t *payload = buf + off + sizeof hdr;
+		off += sizeof hdr + hdr.len;
+
+		switch (hdr.type) {
+		case CONTROL_START:
+			timer_event(s, TIMER_EV_BEGIN, 0);
+			break;
+		case CONTROL_SPLIT:
+			timer_event(s, TIMER_EV_SPLIT, s->timer);
+			break;
+		case CONTROL_RESET:
+			timer_manual_reset(s);
+			break;
+		case CONTROL_UNDO:
+			timer_undo(s);
+			break;
+		case CONTROL_SKIP:
+			timer_skip(s);
+			break;
+		case CONTROL_QUERY:
+			_send_state(s, c);
+			break;
+		case CONTROL_SUBSCRIBE:
+			c->subscribed = true;
+			_send_state(s, c);
+			break;
+		case CONTROL_UNSUBSCRIBE:
+			c->subscribed = false;
+			break;
+		case CONTROL_PROFILE: {
+			uint32_t idx;
+			if (hdr.len < sizeof idx) return -1;
+			memcpy(&idx, payload, sizeof idx);
+			profile_switch(s, idx);
+			break;
+		}
+		default:
+			return -1;
+		}
+	}
+
+	return off;
+}
+
+void control_push(struct state *s, struct control_conn *c) {
+	if (!c->subscribed) return;
+
+	if (c->resync) {
+		_send_state(s, c);
+		return;
+	}
+
+	struct control_state st = _get_state(s);
+
+	uint8_t payload[sizeof (uint32_t) + 4 * sizeof (uint64_t)];
+	uint32_t mask = 0;
+	size_t len = sizeof mask;
+
+#define FIELD(bit, f) \
+	if (st.f != c->last.f) { \
+		uint64_t v = st.f; \
+		memcpy(payload + len, &v, sizeof v); \
+		len += sizeof v; \
+		mask |= bit; \
+	}
+
+	FIELD(CONTROL_F_ACTIVE_SPLIT, active_split)
+	FIELD(CONTROL_F_TIMER, timer)
+	FIELD(CONTROL_F_SPLIT_TIME, split_time)
+	FIELD(CONTROL_F_PROFILE, profile)
+
+#undef FIELD
+
+	if (!mask) return;
+
+	memcpy(payload, &mask, sizeof mask);
+	_send(c, CONTROL_DELTA, payload, len);
+	c->last = st;
+}
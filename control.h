@@ -0,0 +1,70 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "common.h"
+
+// The control socket protocol. Every message in either direction is a
+// struct control_hdr followed by len bytes of payload, all in host byte
+// order, as the socket is only reachable from the local machine
+
+enum control_type {
+	// Client to adrift; no payload unless noted
+	CONTROL_START = 1, // Begin a new run at time 0
+	CONTROL_SPLIT,
+	CONTROL_RESET,
+	CONTROL_UNDO, // Return to the previous split, clearing its time
+	CONTROL_SKIP, // Move to the next split without a time
+	CONTROL_QUERY, // Reply with a CONTROL_STATE
+	CONTROL_SUBSCRIBE, // Send a CONTROL_STATE, then CONTROL_DELTAs on changes
+	CONTROL_UNSUBSCRIBE,
+	CONTROL_PROFILE, // uint32_t index of the profile to switch to; ignored during a run
+
+	// adrift to client
+	CONTROL_STATE = 0x80, // struct control_state
+	CONTROL_DELTA, // uint32_t mask of CONTROL_F_*, then a uint64_t for each set bit in order
+};
+
+enum control_field {
+	CONTROL_F_ACTIVE_SPLIT = 1 << 0,
+	CONTROL_F_TIMER = 1 << 1,
+	CONTROL_F_SPLIT_TIME = 1 << 2,
+	CONTROL_F_PROFILE = 1 << 3,
+};
+
+struct control_hdr {
+	uint8_t type;
+	uint8_t pad;
+	uint16_t len;
+};
+
+struct control_state {
+	// -1 if no run is in progress; as a delta field, it's sign-extended to
+	// 64 bits
+	int64_t active_split;
+	// Microseconds
+	uint64_t timer;
+	uint64_t split_time;
+	// Index of the active profile, in the order given on the command line
+	uint64_t profile;
+};
+
+struct control_conn {
+	int fd;
+	bool subscribed;
+	// Set when a message couldn't be sent, so the next push must send the
+	// whole state rather than a delta
+	bool resync;
+	// The state as last sent to a subscriber
+	struct control_state last;
+};
+
+// Handle every complete message in buf from a client. Must be called with
+// the state locked. Returns the number of bytes consumed, or -1 if the
+// client sent something invalid and should be disconnected
+long control_handle(struct state *s, struct control_conn *c, const uint8_t *buf, size_t len);
+
+// Send a subscribed client whatever has changed since it was last sent
+// the state. Must be called with the state locked
+void control_push(struct state *s, struct control_conn *c);
+
+#endif
@@ -1,95 +1,82 @@
 #include "draw.h"
 #include "common.h"
 #include "calc.h"
+#include "predict.h"
 #include <inttypes.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
+#define STATS_SUBSYS STATS_DRAW
+#include "stats.h"
+
 #define TEXT_PAD 3
+#define MAX_FONTS 8
+
+// The metrics of the font at one size, so that text can be positioned
+// without asking cairo every frame
+struct font_metrics {
+	double size;
+	double ascent, descent;
+	// The advance widths of printable ASCII characters, measured when
+	// first needed; negative if not measured yet
+	double adv[95];
+};
 
-static void set_color_cfg(struct state *s, const char *k, float r, float g, float b, float a) {
-	config_get_color(s->cfg, k, &r, &g, &b, &a);
-	cairo_set_source_rgba(s->cr, r, g, b, a);
-}
+// Where a widget goes in the window, worked out by the layout pass
+struct box {
+	int y, height;
+};
 
-// To stop the timer position doing weird things, we assume the width of
-// digits is constant
-int get_approx_time_width(struct state *s, const char *str) {
-	size_t len = strlen(str) + 1;
-	char *buf = malloc(len);
-	for (size_t i = 0; i < len; ++i) {
-		char c = str[i];
-		if (c >= '0' && c <= '9') {
-			buf[i] = '0';
-		} else {
-			buf[i] = c;
-		}
-	}
-	cairo_text_extents_t ext;
-	cairo_text_extents(s->cr, buf, &ext);
-	free(buf);
-	return ext.width;
-}
+// A widget's content which only changes on split or reset, rendered
+// offscreen and reused until then
+struct layer {
+	cairo_surface_t *surf;
+	// s->static_gen and the layer's size when it was rendered
+	unsigned gen;
+	int w, height;
+	// For the split list, where in the layer the active row goes, or -1
+	// if it isn't shown
+	int active_y;
+};
 
-const char *format_time(uint64_t total, char prefix, int prec) {
-	if (total == UINT64_MAX) return "-";
+static const double _font_sizes[] = {
+	[WIDGET_GAME_NAME] = 23.0,
+	[WIDGET_CATEGORY_NAME] = 16.0,
+	[WIDGET_TIMER] = 26.0,
+	[WIDGET_SPLIT_TIMER] = 24.0,
+	[WIDGET_SPLITS] = 16.0,
+	[WIDGET_SUM_OF_BEST] = 17.0,
+	[WIDGET_BEST_POSSIBLE_TIME] = 17.0,
+	[WIDGET_SPACER] = 0.0,
+	[WIDGET_LABEL] = 16.0,
+	[WIDGET_PB_CHANCE] = 17.0,
+	[WIDGET_PREDICTED_FINISH] = 17.0,
+	[WIDGET_TIME_SAVE] = 17.0,
+};
 
-	static char buf[64];
+static size_t _nfonts;
+static struct font_metrics _fonts[MAX_FONTS];
 
-	// The logic for calculating frac is pretty simple but it's still
-	// easier to just switch on the precision
-	uint64_t frac;
-	switch (prec) {
-	case 0:
-		frac = 0;
-		break;
-	case 1:
-		frac = (total / 100000) % 10;
-		break;
-	case 2:
-		frac = (total / 10000) % 100;
-		break;
-	case 3:
-		frac = (total / 1000) % 1000;
-		break;
-	case 4:
-		frac = (total / 100) % 10000;
-		break;
-	case 5:
-		frac = (total / 10) % 100000;
-		break;
-	case 6:
-	default:
-		frac = total % 1000000;
-		break;
-	}
+// The widgets and window size the layout was worked out for
+static const struct widget *_layout_widgets;
+static int _layout_w, _layout_h;
 
-	total /= 1000000;
-	uint64_t secs = total % 60;
-	total /= 60;
-	uint64_t mins = total % 60;
-	total /= 60;
-	uint64_t hrs = total;
-
-	char *ptr = buf;
-	size_t bufsz = sizeof buf;
-	if (prefix) {
-		buf[0] = prefix;
-		++ptr;
-		--bufsz;
-	}
+static size_t _nboxes;
+static struct box *_boxes;
+static struct layer *_layers;
 
-	if (hrs) {
-		snprintf(ptr, bufsz, "%"PRIu64":%02"PRIu64":%02"PRIu64".%0*"PRIu64, hrs, mins, secs, prec, frac);
-	} else if (mins) {
-		snprintf(ptr, bufsz, "%"PRIu64":%02"PRIu64".%0*"PRIu64, mins, secs, prec, frac);
-	} else {
-		snprintf(ptr, bufsz, "%"PRIu64".%0*"PRIu64, secs, prec, frac);
-	}
+static struct time_cell _timer_cell = { .prec = -1 };
+static struct time_cell _split_timer_cell = { .prec = -1 };
+static struct time_cell _sob_cell = { .prec = -1 };
+static struct time_cell _bpt_cell = { .prec = -1 };
+static struct time_cell _finish_cell = { .prec = -1 };
+static struct time_cell _save_cell = { .prec = -1 };
 
-	return buf;
+static void set_color_cfg(struct state *s, const char *k, float r, float g, float b, float a) {
+	config_get_color(s->cfg, k, &r, &g, &b, &a);
+	cairo_set_source_rgba(s->cr, r, g, b, a);
 }
 
 enum align {
@@ -99,115 +86,224 @@ enum align {
 	ALIGN_RIGHT_TIME,
 };
 
-int get_font_height(struct state *s) {
+// Set the font size, and return its metrics
+static struct font_metrics *_use_font(struct state *s, double size) {
+	cairo_set_font_size(s->cr, size);
+
+	for (size_t i = 0; i < _nfonts; ++i) {
+		if (_fonts[i].size == size) return &_fonts[i];
+	}
+
+	// There are only a handful of sizes, so this shouldn't fill up, but
+	// if it does, reuse the last slot
+	struct font_metrics *f = &_fonts[_nfonts < MAX_FONTS ? _nfonts++ : MAX_FONTS - 1];
+
 	cairo_font_extents_t ext;
 	cairo_font_extents(s->cr, &ext);
-	return ext.ascent + ext.descent;
+
+	f->size = size;
+	f->ascent = ext.ascent;
+	f->descent = ext.descent;
+	for (size_t i = 0; i < sizeof f->adv / sizeof f->adv[0]; ++i) {
+		f->adv[i] = -1;
+	}
+
+	return f;
 }
 
-void draw_text(struct state *s, const char *str, int w, int h, int *y, bool update_y, enum align align, int off) {
-	int width;
-	if (align == ALIGN_RIGHT_TIME) {
-		width = get_approx_time_width(s, str);
-	} else {
-		cairo_text_extents_t ext;
-		cairo_text_extents(s->cr, str, &ext);
-		width = ext.width;
+static int _line_height(struct font_metrics *f) {
+	return 2 * TEXT_PAD + f->ascent + f->descent;
+}
+
+// The width of a string in the current font. If approx_digits is set,
+// every digit is taken to be as wide as '0', which stops times moving
+// around as they change
+static double _text_width(struct state *s, struct font_metrics *f, const char *str, bool approx_digits) {
+	double width = 0;
+
+	for (const char *p = str; *p; ++p) {
+		unsigned char c = *p;
+		if (approx_digits && c >= '0' && c <= '9') c = '0';
+
+		if (c < ' ' || c > '~') {
+			// Only names have other characters, and they're drawn into
+			// layers, so just measure the whole thing
+			cairo_text_extents_t ext;
+			cairo_text_extents(s->cr, str, &ext);
+			return ext.x_advance;
+		}
+
+		if (f->adv[c - ' '] < 0) {
+			char buf[2] = { c, 0 };
+			cairo_text_extents_t ext;
+			cairo_text_extents(s->cr, buf, &ext);
+			f->adv[c - ' '] = ext.x_advance;
+		}
+
+		width += f->adv[c - ' '];
 	}
-	cairo_font_extents_t fext;
-	cairo_font_extents(s->cr, &fext);
-	int old = *y;
-	*y += TEXT_PAD + fext.ascent;
+
+	return width;
+}
+
+// Draw a line of text whose box starts at y
+static void draw_text(struct state *s, struct font_metrics *f, const char *str, int w, int y, enum align align, int off) {
+	double x = 0;
 	switch (align) {
 	case ALIGN_LEFT:
-		cairo_move_to(s->cr, off + TEXT_PAD, *y);
+		x = off + TEXT_PAD;
 		break;
 	case ALIGN_CENTER:
-		cairo_move_to(s->cr, off + (w - off - width) / 2, *y);
+		x = off + (w - off - _text_width(s, f, str, false)) / 2;
 		break;
 	case ALIGN_RIGHT:
+		x = w - off - TEXT_PAD - _text_width(s, f, str, false);
+		break;
 	case ALIGN_RIGHT_TIME:
-		cairo_move_to(s->cr, w - off - TEXT_PAD - width, *y);
+		x = w - off - TEXT_PAD - _text_width(s, f, str, true);
 		break;
 	}
+	cairo_move_to(s->cr, x, y + TEXT_PAD + f->ascent);
 	cairo_show_text(s->cr, str);
-	*y += TEXT_PAD + fext.descent;
-	if (!update_y) *y = old;
 }
 
-void draw_splits(struct state *s, int w, int h, int *y, int off, struct split *splits, size_t nsplits) {
-	cairo_set_font_size(s->cr, 16.0f);
-	for (size_t i = 0; i < nsplits; ++i) {
-		struct times times = get_split_times(&splits[i]);
-		uint64_t comparison = get_comparison(s, times);
-		uint64_t cur = times.cur;
+// Draw a row of the split list at y, in the font f
+static void draw_split(struct state *s, struct font_metrics *f, int w, int y, int off, struct split *sp) {
+	struct times times = get_split_times(sp);
+	uint64_t comparison = get_comparison(s, times);
+	uint64_t cur = times.cur;
 
-		bool active = !splits[i].is_group && splits[i].split.id == s->active_split;
+	bool active = !sp->is_group && sp->split.id == s->active_split;
 
-		if (active) {
-			set_color_cfg(s, "col_active_split", 0.3, 0.5, 0.8, 1.0);
-			cairo_rectangle(s->cr, 0, *y, w, get_font_height(s) + 2 * TEXT_PAD);
-			cairo_fill(s->cr);
-		}
+	if (active) {
+		set_color_cfg(s, "col_active_split", 0.3, 0.5, 0.8, 1.0);
+		cairo_rectangle(s->cr, 0, y, w, _line_height(f));
+		cairo_fill(s->cr);
+	}
 
-		// For the active split, we want to display the delta as soon as it goes over gold
-		if (active && (s->split_time > times.best)) {
-			cur = s->timer;
-		}
+	// For the active split, we want to display the delta as soon as it goes over gold
+	if (active && (s->split_time > times.best)) {
+		cur = s->timer;
+	}
 
-		// If there's an active comparison *and* a current split time, find
-		// the delta
-		const char *delta = "-";
-		if (cur == UINT64_MAX && comparison == UINT64_MAX) {
-				delta = "";
-		} else if (cur != UINT64_MAX && comparison != UINT64_MAX) {
-			if (cur < comparison) delta = format_time(comparison - cur, '-', 2);
-			else delta = format_time(cur - comparison, '+', 2);
-		}
+	// If there's an active comparison *and* a current split time, find
+	// the delta
+	const char *delta = "-";
+	if (cur == UINT64_MAX && comparison == UINT64_MAX) {
+			delta = "";
+	} else if (cur != UINT64_MAX && comparison != UINT64_MAX) {
+		if (cur < comparison) delta = format_time_cell(&sp->fmt_delta, comparison - cur, '-', 2);
+		else delta = format_time_cell(&sp->fmt_delta, cur - comparison, '+', 2);
+	}
 
-		if (times.golded_this_run && !splits[i].is_group) {
-			set_color_cfg(s, "col_split_gold", 1.0, 0.9, 0.3, 1.0);
-		} else if (cur != UINT64_MAX && comparison != UINT64_MAX) {
-			if (cur < comparison) {
-				set_color_cfg(s, "col_split_ahead", 0.2, 1.0, 0.2, 1.0);
-			} else {
-				set_color_cfg(s, "col_split_behind", 1.0, 0.2, 0.2, 1.0);
-			}
+	if (times.golded_this_run && !sp->is_group) {
+		set_color_cfg(s, "col_split_gold", 1.0, 0.9, 0.3, 1.0);
+	} else if (cur != UINT64_MAX && comparison != UINT64_MAX) {
+		if (cur < comparison) {
+			set_color_cfg(s, "col_split_ahead", 0.2, 1.0, 0.2, 1.0);
 		} else {
-			set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
+			set_color_cfg(s, "col_split_behind", 1.0, 0.2, 0.2, 1.0);
 		}
+	} else {
+		set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
+	}
 
-		draw_text(s, delta, w, h, y, false, ALIGN_RIGHT_TIME, config_get_int(s->cfg, "split_time_width", 100));
+	draw_text(s, f, delta, w, y, ALIGN_RIGHT_TIME, config_get_int(s->cfg, "split_time_width", 100));
 
-		// For splits before active, draw the time obtained
-		// For splits after, draw the comparison
-		set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
-		if (cur == UINT64_MAX || active) {
-			draw_text(s, format_time(comparison, 0, 2), w, h, y, false, ALIGN_RIGHT, 0);
-		} else {
-			draw_text(s, format_time(cur, 0, 2), w, h, y, false, ALIGN_RIGHT, 0);
+	// For splits before active, draw the time obtained
+	// For splits after, draw the comparison
+	set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
+	if (cur == UINT64_MAX || active) {
+		draw_text(s, f, format_time_cell(&sp->fmt_time, comparison, 0, 2), w, y, ALIGN_RIGHT, 0);
+	} else {
+		draw_text(s, f, format_time_cell(&sp->fmt_time, cur, 0, 2), w, y, ALIGN_RIGHT, 0);
+	}
+
+	set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
+	draw_text(s, f, sp->name, w, y, ALIGN_LEFT, off);
+}
+
+// Draw only the rows of the split list which fit in its box, scrolled
+// to keep the active split in view with split_lookahead rows after it.
+// Unless split_pin_final is 0, the last row is always shown at the bottom.
+// If active_y isn't NULL, the active row is left blank and its position
+// stored there, or -1 if it isn't shown
+static void draw_splits(struct state *s, int w, int y, int height, int *active_y) {
+	struct font_metrics *f = _use_font(s, _font_sizes[WIDGET_SPLITS]);
+
+	int row_h = _line_height(f);
+	long max_rows = config_get_int(s->cfg, "split_rows", 0);
+	long lookahead = config_get_int(s->cfg, "split_lookahead", 1);
+	if (lookahead < 0) lookahead = 0;
+	bool pin_final = config_get_int(s->cfg, "split_pin_final", 1);
+
+	size_t nrows = s->nrows;
+	size_t visible = height > 0 ? height / row_h : 0;
+	if (max_rows > 0 && (size_t)max_rows < visible) visible = max_rows;
+	if (active_y) *active_y = -1;
+	if (visible == 0) return;
+
+	size_t first = 0, count = nrows;
+	bool pinned = false;
+
+	if (nrows > visible) {
+		count = visible;
+		if (pin_final && visible > 1) {
+			--count;
+			pinned = true;
 		}
 
-		set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
-		draw_text(s, splits[i].name, w, h, y, true, ALIGN_LEFT, off);
+		// With no active split, show the end of a finished run, or
+		// otherwise the start
+		size_t active = s->active_row;
+		if (active == nrows) {
+			active = get_final_split(s)->split.times.cur != UINT64_MAX ? nrows - 1 : 0;
+		}
 
-		if (splits[i].is_group && splits[i].group.expanded) {
-			draw_splits(s, w, h, y, off + 20, splits[i].group.splits, splits[i].group.nsplits);
+		size_t want_last = active + lookahead;
+		if (want_last >= nrows) want_last = nrows - 1;
+		if (want_last >= count) first = want_last - count + 1;
+		if (first > active) first = active;
+		if (first + count > nrows) first = nrows - count;
+
+		// The pinned row would just repeat the last row in the window
+		if (pinned && first + count == nrows) {
+			pinned = false;
+			++count;
+			--first;
 		}
 	}
+
+	for (size_t i = first; i < first + count; ++i) {
+		if (active_y && i == s->active_row) {
+			*active_y = y;
+		} else {
+			draw_split(s, f, w, y, s->rows[i].depth * 20, s->rows[i].split);
+		}
+		y += row_h;
+	}
+
+	if (pinned) {
+		struct split_row *row = &s->rows[nrows - 1];
+		draw_split(s, f, w, y, row->depth * 20, row->split);
+	}
 }
 
-void draw_widget(struct state *s, enum widget_type t, int w, int h, int *y) {
-	switch (t) {
+// Draw a widget whose box starts at y
+static void draw_widget(struct state *s, const struct widget *wd, int w, int y, int height) {
+	struct font_metrics *f = NULL;
+	if (_font_sizes[wd->type]) {
+		f = _use_font(s, _font_sizes[wd->type]);
+	}
+
+	switch (wd->type) {
 	case WIDGET_GAME_NAME:
 		set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
-		cairo_set_font_size(s->cr, 23.0f);
-		draw_text(s, s->game_name, w, h, y, true, ALIGN_CENTER, 0);
+		draw_text(s, f, s->game_name, w, y, ALIGN_CENTER, 0);
 		break;
 	case WIDGET_CATEGORY_NAME:
 		set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
-		cairo_set_font_size(s->cr, 16.0f);
-		draw_text(s, s->category_name, w, h, y, true, ALIGN_CENTER, 0);
+		draw_text(s, f, s->category_name, w, y, ALIGN_CENTER, 0);
 		break;
 	case WIDGET_TIMER:
 		set_color_cfg(s, "col_timer", 1.0, 1.0, 1.0, 1.0);
@@ -220,8 +316,7 @@ void draw_widget(struct state *s, enum widget_type t, int w, int h, int *y) {
 				set_color_cfg(s, "col_timer_behind", 1.0, 1.0, 1.0, 1.0);
 			}
 		}
-		cairo_set_font_size(s->cr, 26.0f);
-		draw_text(s, format_time(s->timer, 0, 3), w, h, y, true, ALIGN_RIGHT_TIME, 0);
+		draw_text(s, f, format_time_cell(&_timer_cell, s->timer, 0, 3), w, y, ALIGN_RIGHT_TIME, 0);
 		break;
 	case WIDGET_SPLIT_TIMER:
 		set_color_cfg(s, "col_timer", 1.0, 1.0, 1.0, 1.0);
@@ -241,41 +336,204 @@ void draw_widget(struct state *s, enum widget_type t, int w, int h, int *y) {
 				set_color_cfg(s, "col_timer_behind", 1.0, 1.0, 1.0, 1.0);
 			}
 		}
-		cairo_set_font_size(s->cr, 24.0f);
-		draw_text(s, format_time(s->split_time, 0, 3), w, h, y, true, ALIGN_RIGHT_TIME, 0);
+		draw_text(s, f, format_time_cell(&_split_timer_cell, s->split_time, 0, 3), w, y, ALIGN_RIGHT_TIME, 0);
 		break;
 	case WIDGET_SPLITS:
-		draw_splits(s, w, h, y, 0, s->splits, s->nsplits);
+		draw_splits(s, w, y, height, NULL);
 		break;
 	case WIDGET_SUM_OF_BEST:
 		set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
-		cairo_set_font_size(s->cr, 17.0f);
-		draw_text(s, "Sum of best:", w, h, y, false, ALIGN_LEFT, 0);
-		draw_text(s, format_time(calc_sum_of_best(s), 0, 3), w, h, y, true, ALIGN_RIGHT, 0);
+		draw_text(s, f, "Sum of best:", w, y, ALIGN_LEFT, 0);
+		draw_text(s, f, format_time_cell(&_sob_cell, calc_sum_of_best(s), 0, 3), w, y, ALIGN_RIGHT, 0);
 		break;
 	case WIDGET_BEST_POSSIBLE_TIME:
 		set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
-		cairo_set_font_size(s->cr, 17.0f);
-		draw_text(s, "Best possible time:", w, h, y, false, ALIGN_LEFT, 0);
-		draw_text(s, format_time(calc_best_possible_time(s), 0, 3), w, h, y, true, ALIGN_RIGHT, 0);
+		draw_text(s, f, "Best possible time:", w, y, ALIGN_LEFT, 0);
+		draw_text(s, f, format_time_cell(&_bpt_cell, calc_best_possible_time(s), 0, 3), w, y, ALIGN_RIGHT, 0);
+		break;
+	case WIDGET_PB_CHANCE: {
+		struct prediction p = predict_get();
+		char buf[16] = "-";
+		if (p.chance_ppm != UINT64_MAX) {
+			snprintf(buf, sizeof buf, "%.1f%%", p.chance_ppm / 10000.0);
+		}
+		set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
+		draw_text(s, f, "Chance to PB:", w, y, ALIGN_LEFT, 0);
+		draw_text(s, f, buf, w, y, ALIGN_RIGHT, 0);
+		break;
+	}
+	case WIDGET_PREDICTED_FINISH:
+		set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
+		draw_text(s, f, "Predicted finish:", w, y, ALIGN_LEFT, 0);
+		draw_text(s, f, format_time_cell(&_finish_cell, predict_get().finish, 0, 1), w, y, ALIGN_RIGHT, 0);
 		break;
+	case WIDGET_TIME_SAVE:
+		set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
+		draw_text(s, f, "Likely time save:", w, y, ALIGN_LEFT, 0);
+		draw_text(s, f, format_time_cell(&_save_cell, predict_get().save, '-', 1), w, y, ALIGN_RIGHT, 0);
+		break;
+	case WIDGET_SPACER:
+		break;
+	case WIDGET_LABEL:
+		set_color_cfg(s, "col_text", 1.0, 1.0, 1.0, 1.0);
+		draw_text(s, f, wd->text, w, y, ALIGN_CENTER, 0);
+		break;
+	}
+}
+
+static bool _is_static(enum widget_type t) {
+	switch (t) {
+	case WIDGET_GAME_NAME:
+	case WIDGET_CATEGORY_NAME:
+	case WIDGET_SUM_OF_BEST:
+	case WIDGET_SPLITS:
+	case WIDGET_LABEL:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Work out every widget's box. Each split list takes an equal share of
+// whatever height the other widgets leave
+static void _layout(struct state *s, int w, int h) {
+	if (_nboxes != s->nwidgets) {
+		draw_free();
+		_boxes = calloc(s->nwidgets, sizeof _boxes[0]);
+		_layers = calloc(s->nwidgets, sizeof _layers[0]);
+		_nboxes = s->nwidgets;
+	}
+
+	int fixed = 0;
+	int nflex = 0;
+
+	for (size_t i = 0; i < s->nwidgets; ++i) {
+		const struct widget *wd = &s->widgets[i];
+		int height = 0;
+
+		if (wd->type == WIDGET_SPLITS) {
+			++nflex;
+		} else if (wd->type == WIDGET_SPACER) {
+			height = wd->height;
+		} else {
+			height = _line_height(_use_font(s, _font_sizes[wd->type]));
+		}
+
+		_boxes[i].height = height;
+		fixed += height;
+	}
+
+	int flex = nflex && h > fixed ? (h - fixed) / nflex : 0;
+
+	int y = 0;
+	for (size_t i = 0; i < s->nwidgets; ++i) {
+		if (s->widgets[i].type == WIDGET_SPLITS) {
+			_boxes[i].height = flex;
+		}
+		_boxes[i].y = y;
+		y += _boxes[i].height;
+	}
+
+	_layout_widgets = s->widgets;
+	_layout_w = w;
+	_layout_h = h;
+}
+
+// Render a widget's static content into its layer. Returns false if the
+// surface couldn't be created, in which case it must be drawn directly
+static bool _render_layer(struct state *s, struct layer *l, const struct widget *wd, int w, int height) {
+	if (l->surf) cairo_surface_destroy(l->surf);
+
+	l->surf = cairo_surface_create_similar(cairo_get_target(s->cr), CAIRO_CONTENT_COLOR_ALPHA, w, height > 0 ? height : 1);
+	if (cairo_surface_status(l->surf) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(l->surf);
+		l->surf = NULL;
+		return false;
+	}
+
+	// The widget drawing code draws to s->cr, so point it at the layer
+	cairo_t *win_cr = s->cr;
+	s->cr = cairo_create(l->surf);
+
+	if (wd->type == WIDGET_SPLITS) {
+		draw_splits(s, w, 0, height, &l->active_y);
+	} else {
+		draw_widget(s, wd, w, 0, height);
+		l->active_y = -1;
+	}
+
+	cairo_destroy(s->cr);
+	s->cr = win_cr;
+
+	l->gen = s->static_gen;
+	l->w = w;
+	l->height = height;
+
+	return true;
+}
+
+// Draw a static widget from its layer, re-rendering it first if needed,
+// then draw the active row on top
+static void _draw_layer(struct state *s, size_t i, int w) {
+	struct layer *l = &_layers[i];
+	struct box *b = &_boxes[i];
+	const struct widget *wd = &s->widgets[i];
+
+	bool valid = l->surf && l->gen == s->static_gen && l->w == w && l->height == b->height;
+	if (!valid && !_render_layer(s, l, wd, w, b->height)) {
+		draw_widget(s, wd, w, b->y, b->height);
+		return;
+	}
+
+	cairo_set_source_surface(s->cr, l->surf, 0, b->y);
+	cairo_rectangle(s->cr, 0, b->y, w, b->height);
+	cairo_fill(s->cr);
+
+	if (l->active_y != -1) {
+		struct split_row *row = &s->rows[s->active_row];
+		struct font_metrics *f = _use_font(s, _font_sizes[WIDGET_SPLITS]);
+		draw_split(s, f, w, b->y + l->active_y, row->depth * 20, row->split);
 	}
 }
 
+void draw_free(void) {
+	for (size_t i = 0; i < _nboxes; ++i) {
+		if (_layers[i].surf) cairo_surface_destroy(_layers[i].surf);
+	}
+	free(_layers);
+	free(_boxes);
+	_layers = NULL;
+	_boxes = NULL;
+	_nboxes = 0;
+	_layout_widgets = NULL;
+}
+
 void draw_handler(vtk_event ev, void *u) {
 	struct state *s = u;
 
+	mtx_lock(&s->lock);
+
 	int w, h;
 	vtk_window_get_size(s->win, &w, &h);
 
+	if (s->widgets != _layout_widgets || s->nwidgets != _nboxes || w != _layout_w || h != _layout_h) {
+		_layout(s, w, h);
+	}
+
 	cairo_rectangle(s->cr, 0, 0, w, h);
 	set_color_cfg(s, "col_background", 0.0, 0.0, 0.0, 0.0);
 	cairo_fill(s->cr);
 
-	int y = 0;
-
 	for (size_t i = 0; i < s->nwidgets; ++i) {
-		draw_widget(s, s->widgets[i], w, h, &y);
+		if (_is_static(s->widgets[i].type)) {
+			_draw_layer(s, i, w);
+		} else {
+			draw_widget(s, &s->widgets[i], w, _boxes[i].y, _boxes[i].height);
+		}
 	}
-}
 
+	mtx_unlock(&s->lock);
+
+	startup_mark(STARTUP_FIRST_FRAME);
+	stats_frame();
+}
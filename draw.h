@@ -4,5 +4,7 @@
 #include <vtk.h>
 
 void draw_handler(vtk_event ev, void *u);
+// Free the cached widget layers
+void draw_free(void);
 
 #endif
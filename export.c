@@ -0,0 +1,151 @@
+#include "export.h"
+#include "adrift_shm.h"
+#include "calc.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define STATS_SUBSYS STATS_INPUT
+#include "stats.h"
+
+static char *_name;
+static int _fd = -1;
+static struct adrift_shm *_shm;
+static size_t _len;
+
+// What was last published
+static struct view _last;
+static bool _published;
+
+static void _copy_name(char *dst, const char *src) {
+	strncpy(dst, src ? src : "", ADRIFT_SHM_NAME_SIZE - 1);
+	dst[ADRIFT_SHM_NAME_SIZE - 1] = 0;
+}
+
+// Make room for at least nsplits in the table. Growing the file doesn't
+// disturb readers, who only see the new capacity once it's published
+static bool _reserve(size_t nsplits) {
+	size_t capacity = _shm ? _shm->capacity : 0;
+	if (_shm && nsplits <= capacity) return true;
+
+	while (capacity < nsplits) capacity = capacity ? capacity * 2 : 64;
+
+	size_t len = sizeof *_shm + capacity * sizeof _shm->splits[0];
+	if (ftruncate(_fd, len) == -1) return false;
+
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (p == MAP_FAILED) return false;
+
+	if (_shm) munmap(_shm, _len);
+	_shm = p;
+	_len = len;
+
+	return true;
+}
+
+static void _fill_splits(struct split *splits, size_t nsplits, uint32_t depth) {
+	for (size_t i = 0; i < nsplits; ++i) {
+		if (splits[i].is_group) {
+			_fill_splits(splits[i].group.splits, splits[i].group.nsplits, depth + 1);
+			continue;
+		}
+
+		struct adrift_shm_split *out = &_shm->splits[splits[i].split.id];
+		struct times *t = &splits[i].split.times;
+		out->cur = t->cur;
+		out->pb = t->pb;
+		out->best = t->best;
+		out->depth = depth;
+		out->golded = t->golded_this_run;
+		_copy_name(out->name, splits[i].name);
+	}
+}
+
+bool export_start(struct state *s) {
+	const char *name = config_get_str(s->cfg, "shm_name", NULL);
+	if (!name) return false;
+
+	// Readers may only read it
+	_fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (_fd == -1) {
+		fprintf(stderr, "Warning: failed to open shared memory %s\n", name);
+		return false;
+	}
+
+	_name = strdup(name);
+
+	// Start again from an empty segment, in case one was left behind
+	if (ftruncate(_fd, 0) == -1 || !_reserve(s->nids)) {
+		fprintf(stderr, "Warning: failed to map shared memory %s\n", name);
+		export_stop();
+		return false;
+	}
+
+	memcpy(_shm->magic, ADRIFT_SHM_MAGIC, sizeof _shm->magic);
+	_shm->version = ADRIFT_SHM_VERSION;
+	_published = false;
+
+	export_update(s);
+
+	return true;
+}
+
+void export_update(struct state *s) {
+	if (!_shm) return;
+
+	struct view v = get_view(s);
+	if (_published && view_eq(&v, &_last)) return;
+
+	bool layout = !_published || v.static_gen != _last.static_gen;
+	if (layout && !_reserve(s->nids)) {
+		fputs("Warning: failed to grow shared memory\n", stderr);
+		return;
+	}
+
+	uint32_t seq = atomic_load_explicit(&_shm->seq, memory_order_relaxed);
+	atomic_store_explicit(&_shm->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	struct adrift_shm_state *st = &_shm->state;
+	st->active_split = s->active_split;
+	st->timer = s->timer;
+	st->split_time = s->split_time;
+	st->best_possible_time = calc_best_possible_time(s);
+
+	st->delta = INT64_MIN;
+	if (s->active_split != -1) {
+		uint64_t pb = get_split_by_id(s, s->active_split)->split.times.pb;
+		if (pb != UINT64_MAX) st->delta = (int64_t)(s->timer - pb);
+	}
+
+	if (layout) {
+		_shm->capacity = (_len - sizeof *_shm) / sizeof _shm->splits[0];
+		_fill_splits(s->splits, s->nsplits, 0);
+		st->nsplits = s->nids;
+		st->profile = s->profile;
+		st->layout_gen++;
+		st->sum_of_best = calc_sum_of_best(s);
+		_copy_name(st->game, s->game_name);
+		_copy_name(st->category, s->category_name);
+	}
+
+	atomic_store_explicit(&_shm->seq, seq + 2, memory_order_release);
+
+	_last = v;
+	_published = true;
+}
+
+void export_stop(void) {
+	if (_shm) munmap(_shm, _len);
+	if (_fd != -1) close(_fd);
+	if (_name) shm_unlink(_name);
+	free(_name);
+
+	_shm = NULL;
+	_len = 0;
+	_fd = -1;
+	_name = NULL;
+}
@@ -0,0 +1,17 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "common.h"
+
+// Publishes the state in shared memory, laid out as in adrift_shm.h, if
+// the shm_name config key is set
+
+// Create the segment. Returns false if it's not configured or failed
+bool export_start(struct state *s);
+// Publish the state if anything shown has changed. Must be called with
+// the state locked
+void export_update(struct state *s);
+// Remove the segment
+void export_stop(void);
+
+#endif
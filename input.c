@@ -0,0 +1,785 @@
+#define _GNU_SOURCE
+
+#include "input.h"
+#include "control.h"
+#include "export.h"
+#include "plugin.h"
+#include "predict.h"
+#include "reload.h"
+#include "timer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define STATS_SUBSYS STATS_INPUT
+#include "stats.h"
+
+#define INPUT_BUF_SIZE 4096
+#define MAX_EVENTS 16
+// How often to retry opening a FIFO which doesn't exist or has no writer
+#define REOPEN_INTERVAL_MS 500
+// How long the time may be interpolated past the last update before it's
+// held, in case the splitter has stalled
+#define DEFAULT_INTERPOLATE_MAX_MS 1000
+// How long after exiting the splitter is restarted, doubling each time it
+// exits again soon after, up to the max
+#define RESTART_MIN_MS 250
+#define RESTART_MAX_MS 30000
+// A splitter which ran at least this long is restarted straight away
+#define RESTART_STABLE_MS 10000
+
+enum source_kind {
+	SOURCE_SPLITTER,
+	SOURCE_FIFO,
+	SOURCE_LISTENER,
+	SOURCE_CONN,
+	SOURCE_CONTROL_LISTENER,
+	SOURCE_CONTROL_CONN,
+};
+
+struct source {
+	struct source *next;
+
+	enum source_kind kind;
+	enum input_role role;
+	int priority;
+
+	int fd; // -1 if not currently open
+	pid_t pid; // Splitter only
+	int back_fd; // Splitter only: its stdin, to tell it whether a run is in progress
+	char *path; // FIFO and listeners only
+	struct control_conn ctl; // Control connections only
+
+	// Whether this source has produced data since it was opened. Of the
+	// live timer sources, only those with the highest priority may update
+	// the time
+	bool live;
+	// Lines which couldn't be parsed since it was opened. Only the first is
+	// reported straight away, so a broken source can't flood stderr
+	unsigned nbad;
+
+	size_t len;
+	char buf[INPUT_BUF_SIZE];
+};
+
+static atomic_bool _should_exit;
+static int _wake_fd = -1;
+
+static int _epfd;
+static struct source *_sources;
+
+// Fires every frame while the displayed time is being interpolated
+static int _tick_fd = -1;
+static bool _ticking;
+
+// Notifies of changes to the splits file
+static int _reload_fd = -1;
+
+// A splitter started by input_start_splitter, for the input thread to take
+// over, if pid isn't 0
+static pid_t _early_pid;
+static int _early_fd = -1, _early_back_fd = -1;
+
+// The splitter process, which is restarted if it exits and
+// splitter_restart isn't 0
+static struct source *_splitter;
+static bool _restart;
+static int _child_fd = -1; // Its pidfd, readable once it exits; -1 if not supported
+static int _restart_fd = -1; // Fires when it's time to restart it
+static uint64_t _started; // When it was last started, in microseconds
+static unsigned _restart_delay_ms;
+
+static void _set_fd(struct source *src, int fd) {
+	src->fd = fd;
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = src };
+	epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static struct source *_add_source(enum source_kind kind, enum input_role role, int priority, int fd) {
+	struct source *src = malloc(sizeof *src);
+	*src = (struct source){
+		.next = _sources,
+		.kind = kind,
+		.role = role,
+		.priority = priority,
+		.fd = -1,
+		.pid = 0,
+		.back_fd = -1,
+	};
+	_sources = src;
+
+	if (fd != -1) _set_fd(src, fd);
+
+	return src;
+}
+
+static void _close_source(struct source *src) {
+	if (src->fd != -1) {
+		epoll_ctl(_epfd, EPOLL_CTL_DEL, src->fd, NULL);
+		close(src->fd);
+		src->fd = -1;
+	}
+	if (src->back_fd != -1) {
+		close(src->back_fd);
+		src->back_fd = -1;
+	}
+	if (src->nbad > 1) {
+		fprintf(stderr, "Warning: %u more bad lines of input data\n", src->nbad - 1);
+	}
+
+	src->live = false;
+	src->len = 0;
+	src->nbad = 0;
+}
+
+static void _free_source(struct source *src) {
+	for (struct source **p = &_sources; *p; p = &(*p)->next) {
+		if (*p == src) {
+			*p = src->next;
+			break;
+		}
+	}
+
+	_close_source(src);
+	free(src->path);
+	free(src);
+}
+
+static enum input_role _cfg_role(struct state *s, const char *k, enum input_role def) {
+	const char *v = config_get_str(s->cfg, k, NULL);
+	if (!v) return def;
+	if (!strcmp(v, "timer")) return INPUT_ROLE_TIMER;
+	if (!strcmp(v, "control")) return INPUT_ROLE_CONTROL;
+	fprintf(stderr, "Warning: bad input role '%s' for %s\n", v, k);
+	return def;
+}
+
+/* Start the splitter in the directory dirfd, which may be AT_FDCWD, with
+ * its stdout and stdin on pipes. Returns false if it couldn't be
+ * started. */
+static bool _fork_splitter(int dirfd, pid_t *pid, int *fd, int *back_fd) {
+	int pipefd[2], backfd[2];
+	if (pipe2(pipefd, O_CLOEXEC) == -1) {
+		fputs("Failed to create pipe\n", stderr);
+		return false;
+	}
+
+	// The splitter still works without being told about runs
+	if (pipe2(backfd, O_CLOEXEC) == -1) {
+		backfd[0] = backfd[1] = -1;
+	}
+
+	*pid = fork();
+	if (*pid == 0) {
+		// Child
+		if (dirfd != AT_FDCWD && fchdir(dirfd)) {
+			fputs("Failed to chdir for splitter\n", stderr);
+			exit(1);
+		}
+		dup2(pipefd[1], STDOUT_FILENO);
+		if (backfd[0] != -1) dup2(backfd[0], STDIN_FILENO);
+		signal(SIGPIPE, SIG_DFL);
+		execlp("./splitter", "./splitter", NULL);
+		fputs("Failed to exec splitter\n", stderr);
+		exit(1);
+	} else if (*pid == -1) {
+		fputs("Failed to fork\n", stderr);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		if (backfd[0] != -1) {
+			close(backfd[0]);
+			close(backfd[1]);
+		}
+		return false;
+	}
+
+	// Parent
+
+	close(pipefd[1]);
+	fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+	if (backfd[0] != -1) {
+		close(backfd[0]);
+		fcntl(backfd[1], F_SETFL, O_NONBLOCK);
+	}
+
+	*fd = pipefd[0];
+	*back_fd = backfd[1];
+	return true;
+}
+
+static int _pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+// Read from a started splitter, creating its source the first time
+static void _attach_splitter(struct state *s, pid_t pid, int fd, int back_fd) {
+	if (!_splitter) {
+		enum input_role role = _cfg_role(s, "splitter_role", INPUT_ROLE_TIMER);
+		int priority = config_get_int(s->cfg, "splitter_priority", 0);
+		_splitter = _add_source(SOURCE_SPLITTER, role, priority, -1);
+	}
+
+	_set_fd(_splitter, fd);
+	_splitter->pid = pid;
+	_splitter->back_fd = back_fd;
+
+	// Without a pidfd, the splitter is only noticed exiting when its
+	// stdout closes
+	_child_fd = _pidfd_open(pid);
+	if (_child_fd != -1) {
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &_child_fd };
+		epoll_ctl(_epfd, EPOLL_CTL_ADD, _child_fd, &ev);
+	}
+}
+
+static void _spawn_splitter(struct state *s) {
+	pid_t pid;
+	int fd, back_fd;
+
+	_started = get_mono_us();
+
+	if (_early_pid) {
+		pid = _early_pid;
+		fd = _early_fd;
+		back_fd = _early_back_fd;
+		_early_pid = 0;
+	} else if (!_fork_splitter(AT_FDCWD, &pid, &fd, &back_fd)) {
+		return;
+	}
+
+	_attach_splitter(s, pid, fd, back_fd);
+}
+
+// The splitter plugin to use, if any, from the config and the directory
+// dirfd, which may be AT_FDCWD
+static const char *_plugin_path(struct cfgdict *cfg, int dirfd) {
+	const char *plugin = config_get_str(cfg, "splitter_plugin", NULL);
+	if (!plugin && faccessat(dirfd, "splitter.so", F_OK, 0) == 0) {
+		plugin = "./splitter.so";
+	}
+	return plugin;
+}
+
+void input_start_splitter(struct cfgdict *cfg, int dirfd) {
+	// A plugin needs the state, so the input thread starts it
+	if (_plugin_path(cfg, dirfd)) return;
+
+	if (!_fork_splitter(dirfd, &_early_pid, &_early_fd, &_early_back_fd)) {
+		_early_pid = 0;
+	}
+}
+
+static void _tell(struct source *src, bool active) {
+	const char *msg = active ? "ACTIVE\n" : "IDLE\n";
+
+	if (src->back_fd == -1) return;
+
+	// A splitter which doesn't read its stdin fills the pipe, and then
+	// there's no point telling it anything more
+	if (write(src->back_fd, msg, strlen(msg)) == -1 && errno != EAGAIN) {
+		close(src->back_fd);
+		src->back_fd = -1;
+	}
+}
+
+// Tell splitters whether a run is in progress, so they can poll less
+// often between runs
+static void _tell_splitters(bool active) {
+	for (struct source *src = _sources; src; src = src->next) {
+		_tell(src, active);
+	}
+
+	plugin_set_active(active);
+}
+
+static void _open_fifo(struct source *src) {
+	int fd = open(src->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd != -1) _set_fd(src, fd);
+}
+
+static void _listen(enum source_kind kind, const char *path, enum input_role role, int priority) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "Warning: socket path %s is too long\n", path);
+		return;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) return;
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof addr) == -1 || listen(fd, 8) == -1) {
+		fprintf(stderr, "Warning: failed to listen on %s\n", path);
+		close(fd);
+		return;
+	}
+
+	struct source *src = _add_source(kind, role, priority, fd);
+	src->path = strdup(path);
+}
+
+static bool _owns_time(struct source *src) {
+	if (src->role != INPUT_ROLE_TIMER) return false;
+
+	for (struct source *o = _sources; o; o = o->next) {
+		if (o->live && o->role == INPUT_ROLE_TIMER && o->priority > src->priority) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void _handle_line(struct state *s, struct source *src, char *line) {
+	struct timer_line tl;
+
+	if (timer_parse_line(line, &tl) != TIMER_PARSE_OK || (src->role == INPUT_ROLE_TIMER && !tl.has_time)) {
+		if (src->nbad++ == 0) {
+			fprintf(stderr, "Warning: bad input data! Got line '%s'\n", line);
+		}
+		return;
+	}
+
+	switch (src->role) {
+	case INPUT_ROLE_TIMER:
+		if (_owns_time(src)) {
+			timer_line(s, &tl);
+		}
+		break;
+	case INPUT_ROLE_CONTROL:
+		if (tl.ev == TIMER_EV_RESET) {
+			timer_manual_reset(s);
+		} else if (tl.ev != TIMER_EV_NONE) {
+			timer_event(s, tl.ev, tl.ev == TIMER_EV_BEGIN ? 0 : s->timer);
+		}
+		break;
+	}
+}
+
+/* Handle every complete line, or message for a control connection, in a
+ * source's buffer, and keep the remainder. Returns false if the source
+ * sent something invalid. */
+static bool _handle_buf(struct state *s, struct source *src) {
+	char *start = src->buf, *end = src->buf + src->len, *nl;
+
+	if (src->kind == SOURCE_CONTROL_CONN) {
+		long n = control_handle(s, &src->ctl, (uint8_t *)src->buf, src->len);
+		if (n < 0) return false;
+		start += n;
+	} else {
+		while ((nl = memchr(start, '\n', end - start))) {
+			*nl = 0;
+			_handle_line(s, src, start);
+			start = nl + 1;
+		}
+	}
+
+	src->len = end - start;
+	if (src->len == sizeof src->buf) {
+		// A line longer than the buffer; nobody sends those
+		fputs("Warning: overlong input line\n", stderr);
+		src->len = 0;
+	} else {
+		memmove(src->buf, start, src->len);
+	}
+
+	return true;
+}
+
+/* Read whatever is available from a source and handle it. Returns false
+ * if the source has reached EOF or failed. */
+static bool _read_source(struct state *s, struct source *src) {
+	ssize_t n;
+	do {
+		n = read(src->fd, src->buf + src->len, sizeof src->buf - src->len);
+	} while (n == -1 && errno == EINTR);
+
+	if (n == -1) return errno == EAGAIN;
+	if (n == 0) return false;
+
+	src->live = true;
+	src->len += n;
+
+	if (src->kind == SOURCE_SPLITTER) startup_mark(STARTUP_SPLITTER_ATTACHED);
+
+	return _handle_buf(s, src);
+}
+
+static void _accept(struct source *listener) {
+	enum source_kind kind = listener->kind == SOURCE_CONTROL_LISTENER ? SOURCE_CONTROL_CONN : SOURCE_CONN;
+
+	int fd;
+	while ((fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+		struct source *src = _add_source(kind, listener->role, listener->priority, fd);
+		src->ctl = (struct control_conn){ .fd = fd };
+	}
+}
+
+static void _restart_splitter(struct state *s);
+
+// Restart the splitter after a delay, or straight away if it had been
+// running a while, as it's probably not going to fail again at once
+static void _schedule_restart(struct state *s) {
+	if (get_mono_us() - _started >= RESTART_STABLE_MS * 1000ull) _restart_delay_ms = 0;
+
+	unsigned delay = _restart_delay_ms;
+	_restart_delay_ms = delay == 0 ? RESTART_MIN_MS : delay * 2 < RESTART_MAX_MS ? delay * 2 : RESTART_MAX_MS;
+
+	if (delay == 0) {
+		_restart_splitter(s);
+		return;
+	}
+
+	fprintf(stderr, "Restarting splitter in %ums\n", delay);
+
+	struct itimerspec its = {
+		.it_value.tv_sec = delay / 1000,
+		.it_value.tv_nsec = (delay % 1000) * 1000000L,
+	};
+	timerfd_settime(_restart_fd, 0, &its, NULL);
+}
+
+static void _restart_splitter(struct state *s) {
+	// The splitter is always the first profile's
+	int dirfd = s->profiles[0].dirfd;
+	pid_t pid;
+	int fd, back_fd;
+
+	_started = get_mono_us();
+
+	// It may be missing while it's being replaced, so keep trying
+	if (faccessat(dirfd, "splitter", X_OK, 0) == -1 || !_fork_splitter(dirfd, &pid, &fd, &back_fd)) {
+		_schedule_restart(s);
+		return;
+	}
+
+	_attach_splitter(s, pid, fd, back_fd);
+
+	// The new splitter resets when it connects, which mustn't end the run,
+	// as with a run restored from the journal
+	bool active = s->active_split != -1;
+	s->resumed = active;
+	_tell(_splitter, active);
+}
+
+/* Reap the splitter if it has exited, or wait for it to exit if block,
+ * and restart it. */
+static void _reap_splitter(struct state *s, bool block) {
+	struct source *src = _splitter;
+	if (!src->pid) return;
+
+	int status;
+	if (waitpid(src->pid, &status, block ? 0 : WNOHANG) <= 0) return;
+
+	// Handle whatever it wrote before it exited
+	int pending;
+	while (src->fd != -1 && ioctl(src->fd, FIONREAD, &pending) == 0 && pending > 0) {
+		if (!_read_source(s, src)) break;
+	}
+
+	_close_source(src);
+	src->pid = 0;
+
+	if (_child_fd != -1) {
+		epoll_ctl(_epfd, EPOLL_CTL_DEL, _child_fd, NULL);
+		close(_child_fd);
+		_child_fd = -1;
+	}
+
+	if (WIFSIGNALED(status)) {
+		fprintf(stderr, "Warning: splitter killed by signal %d\n", WTERMSIG(status));
+	} else {
+		fprintf(stderr, "Warning: splitter exited with status %d\n", WEXITSTATUS(status));
+	}
+
+	if (_restart) _schedule_restart(s);
+}
+
+// Run the tick timer only while the timer is running, so adrift is idle
+// otherwise
+static void _update_ticking(struct state *s, long interval_ns) {
+	bool want = interval_ns > 0 && s->active_split != -1 && !s->paused;
+	if (want == _ticking) return;
+
+	struct itimerspec its = { 0 };
+	if (want) {
+		its.it_interval.tv_sec = interval_ns / 1000000000;
+		its.it_interval.tv_nsec = interval_ns % 1000000000;
+		its.it_value = its.it_interval;
+	}
+
+	timerfd_settime(_tick_fd, 0, &its, NULL);
+	_ticking = want;
+}
+
+int input_main(void *u) {
+	struct state *s = u;
+
+	_epfd = epoll_create1(EPOLL_CLOEXEC);
+	_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_epfd == -1 || _wake_fd == -1) {
+		fputs("Failed to create epoll instance\n", stderr);
+		exit(1);
+	}
+
+	struct epoll_event wake_ev = { .events = EPOLLIN, .data.ptr = NULL };
+	epoll_ctl(_epfd, EPOLL_CTL_ADD, _wake_fd, &wake_ev);
+
+	// Interpolate the time at the frame rate, unless it's set to 0
+	long interp_hz = config_get_int(s->cfg, "interpolate_hz", 60);
+	long interval_ns = interp_hz > 0 ? 1000000000 / interp_hz : 0;
+	uint64_t interp_max = (uint64_t)config_get_int(s->cfg, "interpolate_max_ms", DEFAULT_INTERPOLATE_MAX_MS) * 1000;
+
+	_tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (_tick_fd == -1) {
+		fputs("Warning: failed to create timer; the time will not be interpolated\n", stderr);
+		interval_ns = 0;
+	} else {
+		struct epoll_event tick_ev = { .events = EPOLLIN, .data.ptr = &_tick_fd };
+		epoll_ctl(_epfd, EPOLL_CTL_ADD, _tick_fd, &tick_ev);
+	}
+
+	// Prefer running the splitter in-process if it's available as a plugin,
+	// falling back to the executable
+	const char *plugin = _plugin_path(s->cfg, AT_FDCWD);
+
+	if (!plugin || !plugin_start(s, plugin)) {
+		_spawn_splitter(s);
+	}
+
+	if (_splitter && config_get_int(s->cfg, "splitter_restart", 1)) {
+		_restart_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (_restart_fd == -1) {
+			fputs("Warning: failed to create timer; the splitter will not be restarted\n", stderr);
+		} else {
+			struct epoll_event restart_ev = { .events = EPOLLIN, .data.ptr = &_restart_fd };
+			epoll_ctl(_epfd, EPOLL_CTL_ADD, _restart_fd, &restart_ev);
+			_restart = true;
+		}
+	}
+
+	const char *fifo = config_get_str(s->cfg, "input_fifo", NULL);
+	if (fifo) {
+		enum input_role role = _cfg_role(s, "input_fifo_role", INPUT_ROLE_TIMER);
+		struct source *src = _add_source(SOURCE_FIFO, role, config_get_int(s->cfg, "input_fifo_priority", 0), -1);
+		src->path = strdup(fifo);
+		_open_fifo(src);
+	}
+
+	const char *sock = config_get_str(s->cfg, "input_socket", NULL);
+	if (sock) {
+		enum input_role role = _cfg_role(s, "input_socket_role", INPUT_ROLE_CONTROL);
+		_listen(SOURCE_LISTENER, sock, role, config_get_int(s->cfg, "input_socket_priority", 0));
+	}
+
+	const char *ctl = config_get_str(s->cfg, "control_socket", NULL);
+	if (ctl) {
+		_listen(SOURCE_CONTROL_LISTENER, ctl, INPUT_ROLE_CONTROL, 0);
+	}
+
+	// Everything else is in the active profile's directory, which is only
+	// changed by this thread from now on
+	if (s->profile != 0 && fchdir(s->profiles[s->profile].dirfd)) {
+		fprintf(stderr, "Warning: failed to chdir to %s\n", s->profiles[s->profile].path);
+	}
+
+	_reload_fd = reload_watch();
+	if (_reload_fd == -1) {
+		fputs("Warning: failed to watch directory; the splits will not be reloaded\n", stderr);
+	} else {
+		struct epoll_event reload_ev = { .events = EPOLLIN, .data.ptr = &_reload_fd };
+		epoll_ctl(_epfd, EPOLL_CTL_ADD, _reload_fd, &reload_ev);
+	}
+
+	struct epoll_event events[MAX_EVENTS];
+
+	// Whether splitters were last told a run is in progress; -1 if not yet
+	int told_active = -1;
+
+	while (!_should_exit) {
+		// Only wake up without an event to retry opening a FIFO, so that
+		// adrift sleeps entirely while nothing is happening
+		int timeout = -1;
+		for (struct source *src = _sources; src; src = src->next) {
+			if (src->kind == SOURCE_FIFO && src->fd == -1) timeout = REOPEN_INTERVAL_MS;
+		}
+
+		int n = epoll_wait(_epfd, events, MAX_EVENTS, timeout);
+
+		bool reparse = false;
+
+		mtx_lock(&s->lock);
+
+		struct view before = get_view(s);
+
+		for (int i = 0; i < n; ++i) {
+			struct source *src = events[i].data.ptr;
+			if (!src) {
+				// Woken to exit, or because the plugin changed the state
+				uint64_t val;
+				read(_wake_fd, &val, sizeof val);
+				continue;
+			}
+
+			if (src == (void *)&_tick_fd) {
+				uint64_t expirations;
+				read(_tick_fd, &expirations, sizeof expirations);
+				timer_interpolate(s, interp_max);
+				continue;
+			}
+
+			if (src == (void *)&_reload_fd) {
+				if (reload_check()) reparse = true;
+				continue;
+			}
+
+			if (src == (void *)&_child_fd) {
+				_reap_splitter(s, false);
+				continue;
+			}
+
+			if (src == (void *)&_restart_fd) {
+				uint64_t expirations;
+				read(_restart_fd, &expirations, sizeof expirations);
+				_restart_splitter(s);
+				continue;
+			}
+
+			if (src->kind == SOURCE_LISTENER || src->kind == SOURCE_CONTROL_LISTENER) {
+				_accept(src);
+				continue;
+			}
+
+			if (events[i].events & EPOLLIN) {
+				if (_read_source(s, src)) continue;
+			} else if (!(events[i].events & (EPOLLHUP | EPOLLERR))) {
+				continue;
+			}
+
+			// EOF or error
+			switch (src->kind) {
+			case SOURCE_CONN:
+			case SOURCE_CONTROL_CONN:
+				_free_source(src);
+				break;
+			case SOURCE_SPLITTER:
+				_close_source(src);
+				// It has exited, or has stopped writing and is no use any more
+				if (src->pid && _child_fd != -1) {
+					kill(src->pid, SIGTERM);
+				} else if (src->pid) {
+					kill(src->pid, SIGKILL);
+					_reap_splitter(s, true);
+				}
+				break;
+			case SOURCE_FIFO:
+				_close_source(src);
+				break;
+			case SOURCE_LISTENER:
+			case SOURCE_CONTROL_LISTENER:
+				break;
+			}
+		}
+
+		// Subscribers see every change, whichever source it came from
+		for (struct source *src = _sources; src; src = src->next) {
+			if (src->kind == SOURCE_CONTROL_CONN) {
+				control_push(s, &src->ctl);
+			}
+		}
+
+		// New splits are held until the run is reset
+		reload_apply(s);
+
+		_update_ticking(s, interval_ns);
+
+		predict_request(s);
+
+		export_update(s);
+
+		bool active = s->active_split != -1;
+		if (active != told_active) {
+			_tell_splitters(active);
+			told_active = active;
+		}
+
+		// Lines which change nothing drawn, such as the same time again,
+		// don't cause a redraw
+		struct view after = get_view(s);
+		bool updated = !view_eq(&before, &after);
+
+		mtx_unlock(&s->lock);
+
+		// Parse outside the lock so drawing isn't held up; the new splits
+		// are swapped in on the next pass
+		if (reparse) {
+			reload_parse();
+			input_notify();
+		}
+
+		// Writers to a FIFO may come and go, so keep trying to reopen it
+		for (struct source *src = _sources; src; src = src->next) {
+			if (src->kind == SOURCE_FIFO && src->fd == -1) {
+				_open_fifo(src);
+			}
+		}
+
+		// Only wake the window once for every batch of lines
+		if (updated) {
+			vtk_window_trigger_update(s->win);
+		}
+	}
+
+	plugin_stop();
+
+	while (_sources) {
+		struct source *src = _sources;
+		if (src->kind == SOURCE_SPLITTER && src->pid) {
+			kill(src->pid, SIGINT);
+		} else if (src->kind == SOURCE_LISTENER || src->kind == SOURCE_CONTROL_LISTENER) {
+			unlink(src->path);
+		}
+		_free_source(src);
+	}
+
+	reload_stop();
+
+	if (_child_fd != -1) close(_child_fd);
+	if (_restart_fd != -1) close(_restart_fd);
+	if (_tick_fd != -1) close(_tick_fd);
+	close(_wake_fd);
+	close(_epfd);
+
+	return 0;
+}
+
+void input_notify(void) {
+	if (_wake_fd != -1) {
+		uint64_t one = 1;
+		write(_wake_fd, &one, sizeof one);
+	}
+}
+
+void input_stop(void) {
+	_should_exit = true;
+	input_notify();
+}
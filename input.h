@@ -0,0 +1,30 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "common.h"
+
+enum input_role {
+	// Provides game time and events
+	INPUT_ROLE_TIMER,
+	// Provides events only, which are applied at the current time
+	INPUT_ROLE_CONTROL,
+};
+
+// Start the splitter executable in the directory dirfd ahead of the input
+// thread, which takes it over, so that it can be attaching to the game
+// while everything else loads. Does nothing if a plugin is to be used
+// instead
+void input_start_splitter(struct cfgdict *cfg, int dirfd);
+
+// Entry point of the input thread, which reads rift data from the
+// splitter and any other configured sources. u is the struct state
+int input_main(void *u);
+
+// Wake the input thread to pass on a change to the state made elsewhere,
+// such as by the splitter plugin, to control socket subscribers
+void input_notify(void);
+
+// Make the input thread exit
+void input_stop(void);
+
+#endif
@@ -4,6 +4,10 @@
 #include <inttypes.h>
 #include <string.h>
 #include <ctype.h>
+#include <sys/stat.h>
+
+#define STATS_SUBSYS STATS_IO
+#include "stats.h"
 
 static inline size_t _count_tabs(char *line) {
 	size_t i = 0;
@@ -29,6 +33,7 @@ static ssize_t _read_splits(FILE *f, unsigned *id, unsigned level, struct split
 		}
 
 		if (!strcmp(line, "\n")) {
+			free(line);
 			line = NULL;
 			continue;
 		}
@@ -53,6 +58,7 @@ static ssize_t _read_splits(FILE *f, unsigned *id, unsigned level, struct split
 		char *next = NULL;
 
 		splits[nsplits].name = name;
+		splits[nsplits].fmt_delta = splits[nsplits].fmt_time = (struct time_cell){ .prec = -1 };
 
 		struct split *subsplits;
 		ssize_t nsubsplits = _read_splits(f, id, level + 1, &subsplits, &next);
@@ -82,6 +88,7 @@ static ssize_t _read_splits(FILE *f, unsigned *id, unsigned level, struct split
 
 	if (nsplits == 0) {
 		free(splits);
+		splits = NULL;
 	}
 
 	*out = splits;
@@ -104,6 +111,8 @@ ssize_t read_splits_file(const char *path, struct split **out) {
 		fprintf(stderr, "trailing line in splits file: %s", trailing); // We don't print a newline as the trailing line includes one
 		free(trailing);
 		free_splits(*out, nsplits);
+		free(*out);
+		fclose(f);
 		return -1;
 	}
 
@@ -199,57 +208,263 @@ bool save_times(struct split *splits, size_t nsplits, const char *path, size_t o
 	return success;
 }
 
-// TODO: this leaks memory, might be worth not doing that
-bool read_config(const char *path, struct cfgdict *cfg) {
+static void _store_times(struct store *st, size_t off, struct split *splits, size_t nsplits, bool to_store) {
+	for (size_t i = 0; i < nsplits; ++i) {
+		if (splits[i].is_group) {
+			_store_times(st, off, splits[i].group.splits, splits[i].group.nsplits, to_store);
+		} else {
+			uint64_t *time = (uint64_t *)((char *)&splits[i].split.times + off);
+			if (to_store) {
+				store_set(st, splits[i].split.id, *time);
+			} else {
+				*time = st->slots[splits[i].split.id];
+			}
+		}
+	}
+}
+
+// Load times from the binary store at bin_path, unless the text file at
+// text_path is newer (such as after editing it by hand) or the store is
+// missing or invalid, in which case the text file is imported into a new
+// store. Returns false if neither could be read
+bool load_times(struct split *splits, size_t nsplits, size_t nids, struct store *st, const char *text_path, const char *bin_path, size_t off) {
+	struct stat text_sb, bin_sb;
+	bool have_text = stat(text_path, &text_sb) == 0;
+	bool have_bin = stat(bin_path, &bin_sb) == 0;
+
+	bool text_newer = have_text && have_bin && (text_sb.st_mtim.tv_sec > bin_sb.st_mtim.tv_sec
+		|| (text_sb.st_mtim.tv_sec == bin_sb.st_mtim.tv_sec && text_sb.st_mtim.tv_nsec > bin_sb.st_mtim.tv_nsec));
+
+	if (have_bin && !text_newer && store_open(st, bin_path, nids)) {
+		_store_times(st, off, splits, nsplits, false);
+		return true;
+	}
+
+	bool success = read_times(splits, nsplits, text_path, off);
+	create_store(splits, nsplits, nids, st, bin_path, off);
+	return success;
+}
+
+// Create a store at bin_path holding the given times
+bool create_store(struct split *splits, size_t nsplits, size_t nids, struct store *st, const char *bin_path, size_t off) {
+	if (!store_create(st, bin_path, nids)) {
+		fprintf(stderr, "Warning: could not create %s\n", bin_path);
+		return false;
+	}
+
+	_store_times(st, off, splits, nsplits, true);
+	store_sync(st, SIZE_MAX);
+	return true;
+}
+
+// A split identified by the names of the groups it's in and its own name
+struct leaf {
+	char *path;
+	size_t idx; // Position in the tree, to match duplicates in order
+	struct times *times;
+	bool used;
+};
+
+static void _collect_leaves(struct split *splits, size_t nsplits, const char *prefix, struct leaf **leaves, size_t *n, size_t *alloc) {
+	for (size_t i = 0; i < nsplits; ++i) {
+		// Names can't contain newlines, so they separate the parts
+		size_t len = strlen(prefix) + strlen(splits[i].name) + 2;
+		char *path = malloc(len);
+		snprintf(path, len, "%s%s\n", prefix, splits[i].name);
+
+		if (splits[i].is_group) {
+			_collect_leaves(splits[i].group.splits, splits[i].group.nsplits, path, leaves, n, alloc);
+			free(path);
+			continue;
+		}
+
+		if (*n == *alloc) {
+			*alloc = *alloc ? *alloc * 2 : 64;
+			*leaves = realloc(*leaves, *alloc * sizeof (*leaves)[0]);
+		}
+
+		(*leaves)[*n] = (struct leaf){ path, *n, &splits[i].split.times, false };
+		++*n;
+	}
+}
+
+static int _leaf_cmp(const void *a, const void *b) {
+	const struct leaf *la = a, *lb = b;
+	int c = strcmp(la->path, lb->path);
+	if (c) return c;
+	return (la->idx > lb->idx) - (la->idx < lb->idx);
+}
+
+// Copy the pb and gold of every split in the old tree to the split in
+// the new tree with the same name in the same groups. If several have the
+// same name, they're matched up in order. Returns the number carried over
+size_t carry_times(struct split *old, size_t nold, struct split *new, size_t nnew) {
+	struct leaf *old_leaves = NULL, *new_leaves = NULL;
+	size_t nold_leaves = 0, nnew_leaves = 0, alloc = 0;
+
+	_collect_leaves(old, nold, "", &old_leaves, &nold_leaves, &alloc);
+	alloc = 0;
+	_collect_leaves(new, nnew, "", &new_leaves, &nnew_leaves, &alloc);
+
+	qsort(old_leaves, nold_leaves, sizeof old_leaves[0], _leaf_cmp);
+
+	size_t carried = 0;
+
+	for (size_t i = 0; i < nnew_leaves; ++i) {
+		// Find the first unused old leaf with this path
+		size_t lo = 0, hi = nold_leaves;
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			if (strcmp(old_leaves[mid].path, new_leaves[i].path) < 0) lo = mid + 1;
+			else hi = mid;
+		}
+		while (lo < nold_leaves && old_leaves[lo].used && !strcmp(old_leaves[lo].path, new_leaves[i].path)) ++lo;
+
+		if (lo < nold_leaves && !strcmp(old_leaves[lo].path, new_leaves[i].path)) {
+			old_leaves[lo].used = true;
+			new_leaves[i].times->pb = old_leaves[lo].times->pb;
+			new_leaves[i].times->best = old_leaves[lo].times->best;
+			++carried;
+		}
+	}
+
+	for (size_t i = 0; i < nold_leaves; ++i) free(old_leaves[i].path);
+	for (size_t i = 0; i < nnew_leaves; ++i) free(new_leaves[i].path);
+	free(old_leaves);
+	free(new_leaves);
+
+	return carried;
+}
+
+static const char *const _widget_names[] = {
+	[WIDGET_GAME_NAME] = "game_name",
+	[WIDGET_CATEGORY_NAME] = "category_name",
+	[WIDGET_TIMER] = "timer",
+	[WIDGET_SPLIT_TIMER] = "split_timer",
+	[WIDGET_SPLITS] = "splits",
+	[WIDGET_SUM_OF_BEST] = "sum_of_best",
+	[WIDGET_BEST_POSSIBLE_TIME] = "best_possible_time",
+	[WIDGET_SPACER] = "spacer",
+	[WIDGET_LABEL] = "label",
+	[WIDGET_PB_CHANCE] = "pb_chance",
+	[WIDGET_PREDICTED_FINISH] = "predicted_finish",
+	[WIDGET_TIME_SAVE] = "time_save",
+};
+
+// Read the widgets to display from top to bottom, one per line, each
+// optionally followed by an argument
+ssize_t read_layout(const char *path, struct widget **out) {
 	FILE *f = fopen(path, "r");
 
 	if (!f) {
-		return false;
+		return -1;
 	}
 
-	while (true) {
-		size_t allocd = 0;
-		char *line = NULL;
-		size_t n = getline(&line, &allocd, f);
+	size_t widgets_alloc = 8;
+	size_t nwidgets = 0;
+	struct widget *widgets = malloc(widgets_alloc * sizeof widgets[0]);
+
+	char *line = NULL;
+	size_t n = 0;
+	unsigned lineno = 0;
+	bool ok = true;
+
+	while (getline(&line, &n, f) != -1) {
+		++lineno;
+		line[strcspn(line, "\n")] = 0;
+
+		char *name = line;
+		while (isspace(*name)) ++name;
+		if (*name == 0 || *name == '#') continue;
+
+		size_t name_len = strcspn(name, " \t");
+		char *arg = name + name_len;
+		while (isspace(*arg)) ++arg;
+
+		size_t type;
+		for (type = 0; type < sizeof _widget_names / sizeof _widget_names[0]; ++type) {
+			if (strlen(_widget_names[type]) == name_len && !strncmp(name, _widget_names[type], name_len)) break;
+		}
 
-		if (n == -1) {
+		if (type == sizeof _widget_names / sizeof _widget_names[0]) {
+			fprintf(stderr, "Unknown widget '%.*s' on line %u of %s\n", (int)name_len, name, lineno, path);
+			ok = false;
 			break;
 		}
 
+		if (widgets_alloc == nwidgets) {
+			widgets_alloc *= 2;
+			widgets = realloc(widgets, widgets_alloc * sizeof widgets[0]);
+		}
+
+		widgets[nwidgets] = (struct widget){ .type = type };
+		if (type == WIDGET_SPACER) {
+			widgets[nwidgets].height = *arg ? atoi(arg) : 10;
+		} else if (type == WIDGET_LABEL) {
+			widgets[nwidgets].text = strdup(arg);
+		}
+
+		++nwidgets;
+	}
+
+	free(line);
+	fclose(f);
+
+	if (!ok) {
+		free_widgets(widgets, nwidgets);
+		return -1;
+	}
+
+	*out = widgets;
+	return nwidgets;
+}
+
+bool read_config(const char *path, struct cfgdict *cfg) {
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		return false;
+	}
+
+	bool ok = true;
+	size_t allocd = 0;
+	char *line = NULL;
+
+	while (getline(&line, &allocd, f) != -1) {
 		// strip trailing whitespace
 		{
-			char *end = line;
-			while (*end) ++end;
-			--end;
-			while (isspace(*end)) --end;
-			end[1] = 0;
-		}
-
-		if (n > 0) {
-			int p = -1;
-			char *k;
-			int matched = sscanf(line, "%ms %n", &k, &p);
-			if (matched != 1 || p == -1) {
-				if (matched >= 1) free(k);
-				// TODO: clear cfg
-				fclose(f);
-				return false;
-			}
-			char *v = strdup(line + p);
-			int ret = cfgdict_put(cfg, k, v);
-			if (ret == -1) {
-				free(k);
-				free(v);
-				// TODO: clear cfg
-				fclose(f);
-				return false;
-			} else if (ret == 1) {
-				fprintf(stderr, "Warning: duplicate config key %s\n", k);
-			}
+			char *end = line + strlen(line);
+			while (end > line && isspace(end[-1])) --end;
+			*end = 0;
+		}
+
+		char *k = line;
+		while (isspace(*k)) ++k;
+
+		size_t klen = 0;
+		while (k[klen] && !isspace(k[klen])) ++klen;
+
+		if (klen == 0) {
+			// TODO: clear cfg
+			ok = false;
+			break;
+		}
+
+		const char *v = k + klen;
+		while (isspace(*v)) ++v;
+
+		int ret = config_put(cfg, k, klen, v);
+		if (ret == -1) {
+			// TODO: clear cfg
+			ok = false;
+			break;
+		} else if (ret == 1) {
+			fprintf(stderr, "Warning: duplicate config key %.*s\n", (int)klen, k);
 		}
 	}
 
+	free(line);
 	fclose(f);
 
-	return true;
+	return ok;
 }
@@ -6,10 +6,15 @@
 #include <sys/types.h>
 #include "common.h"
 #include "config.h"
+#include "store.h"
 
 ssize_t read_splits_file(const char *path, struct split **out);
 bool read_times(struct split *splits, size_t nsplits, const char *path, size_t off);
+bool load_times(struct split *splits, size_t nsplits, size_t nids, struct store *st, const char *text_path, const char *bin_path, size_t off);
+bool create_store(struct split *splits, size_t nsplits, size_t nids, struct store *st, const char *bin_path, size_t off);
+size_t carry_times(struct split *old, size_t nold, struct split *new, size_t nnew);
 bool save_times(struct split *splits, size_t nsplits, const char *path, size_t off);
+ssize_t read_layout(const char *path, struct widget **out);
 bool read_config(const char *path, struct cfgdict *cfg);
 
 #endif
@@ -0,0 +1,435 @@
+#include "journal.h"
+#include "timer.h"
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STATS_SUBSYS STATS_IO
+#include "stats.h"
+
+#define RUNS_DIR "runs"
+
+// The run as described by the journal so far
+struct run {
+	bool in_run; // Begun and not reset since
+	bool finished;
+	int active_split;
+	time_t started;
+	uint64_t last_time;
+
+	size_t nids;
+	uint64_t *cur;
+};
+
+// The journal of each profile
+struct journal {
+	int fd;
+	int dirfd; // Of the profile, for runs/ and the pb link
+	struct run run;
+	// What pb linked to before the finished run replaced it, if it did, so
+	// that undoing the final split can put it back. NULL if it didn't
+	// exist
+	char *prev_pb;
+};
+
+static struct journal *_journals;
+static size_t _njournals;
+
+static bool _started;
+// The journal records are being appended to, as of the last switch, or -1
+static int _target = -1;
+static thrd_t _thrd;
+static mtx_t _lock;
+static cnd_t _cnd;
+static bool _closing;
+
+// Records queued by journal_append, and those being written, which the
+// writer thread swaps over so that appending never waits for the disk
+static struct journal_rec *_queue, *_batch;
+static size_t _nqueue, _queue_alloc, _batch_alloc;
+
+// The journal records are currently going to. Only touched by the writer
+// thread once it has started
+static struct journal *_cur;
+
+static void _run_apply(struct run *r, const struct journal_rec *rec) {
+	bool valid_split = rec->split >= 0 && (size_t)rec->split < r->nids;
+
+	switch (rec->type) {
+	case JOURNAL_BEGIN:
+		for (size_t i = 0; i < r->nids; ++i) {
+			r->cur[i] = UINT64_MAX;
+		}
+		r->in_run = true;
+		r->finished = false;
+		r->active_split = 0;
+		r->started = rec->time;
+		r->last_time = 0;
+		break;
+	case JOURNAL_SPLIT:
+		if (!r->in_run || !valid_split) break;
+		r->cur[rec->split] = rec->time;
+		r->active_split = rec->split + 1;
+		r->last_time = rec->time;
+		break;
+	case JOURNAL_UNDO:
+		if (!r->in_run || !valid_split) break;
+		r->cur[rec->split] = UINT64_MAX;
+		r->active_split = rec->split;
+		r->finished = false;
+		break;
+	case JOURNAL_SKIP:
+		if (!r->in_run || !valid_split) break;
+		r->active_split = rec->split + 1;
+		break;
+	case JOURNAL_FINISH:
+		if (!r->in_run) break;
+		r->active_split = -1;
+		r->finished = true;
+		r->last_time = rec->time;
+		break;
+	case JOURNAL_RESET:
+		r->in_run = false;
+		r->finished = false;
+		r->active_split = -1;
+		break;
+	case JOURNAL_LAYOUT:
+		// Only happens between runs
+		r->nids = rec->time;
+		r->cur = realloc(r->cur, r->nids * sizeof r->cur[0]);
+		for (size_t i = 0; i < r->nids; ++i) {
+			r->cur[i] = UINT64_MAX;
+		}
+		r->in_run = false;
+		r->finished = false;
+		r->active_split = -1;
+		break;
+	}
+}
+
+static void _run_path(const struct run *r, char *path, size_t len) {
+	strftime(path, len, RUNS_DIR "/%Y-%m-%d_%H.%M.%S", localtime(&r->started));
+}
+
+// The target of the pb link, to be freed, or NULL if there isn't one
+static char *_read_pb(const struct journal *j) {
+	char buf[256];
+	ssize_t n = readlinkat(j->dirfd, "pb", buf, sizeof buf - 1);
+	if (n == -1) return NULL;
+	buf[n] = 0;
+	return strdup(buf);
+}
+
+// Write a finished run to runs/, pointing pb at it if it's a PB. If
+// only_missing is set, a run which has already been written is left alone
+static void _write_run(struct journal *j, bool is_pb, bool only_missing) {
+	const struct run *r = &j->run;
+
+	char path[64];
+	_run_path(r, path, sizeof path);
+
+	free(j->prev_pb);
+	j->prev_pb = NULL;
+
+	if (only_missing && faccessat(j->dirfd, path, F_OK, 0) == 0) return;
+
+	mkdirat(j->dirfd, RUNS_DIR, 0777);
+	int fd = openat(j->dirfd, path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	FILE *f = fd == -1 ? NULL : fdopen(fd, "w");
+	if (!f) {
+		if (fd != -1) close(fd);
+		fprintf(stderr, "Warning: could not write run to %s\n", path);
+		return;
+	}
+
+	// Split ids are in the same order as the splits file
+	for (size_t i = 0; i < r->nids; ++i) {
+		if (r->cur[i] == UINT64_MAX) {
+			fputs("-\n", f);
+		} else {
+			fprintf(f, "%"PRIu64"\n", r->cur[i]);
+		}
+	}
+
+	fclose(f);
+
+	if (is_pb) {
+		j->prev_pb = _read_pb(j);
+		unlinkat(j->dirfd, "pb", 0);
+		symlinkat(path, j->dirfd, "pb");
+	}
+}
+
+// The final split was undone, so the run isn't finished after all: remove
+// it from runs/, and point pb back at what it was before if it had been
+// moved to this run
+static void _unwrite_run(struct journal *j) {
+	char path[64];
+	_run_path(&j->run, path, sizeof path);
+
+	char *pb = _read_pb(j);
+	if (pb && !strcmp(pb, path)) {
+		unlinkat(j->dirfd, "pb", 0);
+		if (j->prev_pb) symlinkat(j->prev_pb, j->dirfd, "pb");
+	}
+	free(pb);
+
+	unlinkat(j->dirfd, path, 0);
+
+	free(j->prev_pb);
+	j->prev_pb = NULL;
+}
+
+// Apply a record to a journal's run, keeping runs/ and the pb link in
+// step with it. only_missing is as for _write_run
+static void _apply(struct journal *j, const struct journal_rec *rec, bool only_missing) {
+	bool was_finished = j->run.finished;
+	_run_apply(&j->run, rec);
+
+	if (rec->type == JOURNAL_FINISH && j->run.finished) {
+		_write_run(j, rec->split, only_missing);
+	} else if (rec->type == JOURNAL_UNDO && was_finished && !j->run.finished) {
+		_unwrite_run(j);
+	}
+}
+
+// Write records to the current journal, up to and not including any
+// switch to another. Returns the number of records handled
+static size_t _write_batch(const struct journal_rec *recs, size_t n) {
+	// Nothing up to the last reset is needed any more, so the journal can
+	// start again after it
+	size_t start = 0, end = 0;
+	bool reset = false;
+
+	if (!_cur) {
+		while (end < n && recs[end].type != JOURNAL_SWITCH) ++end;
+		return end;
+	}
+
+	for (; end < n && recs[end].type != JOURNAL_SWITCH; ++end) {
+		_apply(_cur, &recs[end], false);
+
+		if (recs[end].type == JOURNAL_RESET) {
+			start = end + 1;
+			reset = true;
+		}
+	}
+
+	if (reset && ftruncate(_cur->fd, 0) == -1) {
+		fputs("Warning: failed to truncate journal\n", stderr);
+	}
+
+	const char *buf = (const char *)&recs[start];
+	size_t len = (end - start) * sizeof recs[0];
+	while (len) {
+		ssize_t written = write(_cur->fd, buf, len);
+		if (written == -1) {
+			fputs("Warning: failed to write journal\n", stderr);
+			break;
+		}
+		buf += written;
+		len -= written;
+	}
+
+	// Everything queued while the last batch was being synced goes out
+	// with a single sync
+	if (end > start) fdatasync(_cur->fd);
+
+	return end;
+}
+
+static int _writer_main(void *u) {
+	mtx_lock(&_lock);
+
+	while (true) {
+		while (!_nqueue && !_closing) {
+			cnd_wait(&_cnd, &_lock);
+		}
+
+		if (!_nqueue) break;
+
+		struct journal_rec *recs = _queue;
+		size_t n = _nqueue, alloc = _queue_alloc;
+		_queue = _batch;
+		_queue_alloc = _batch_alloc;
+		_nqueue = 0;
+		_batch = recs;
+		_batch_alloc = alloc;
+
+		mtx_unlock(&_lock);
+		for (size_t i = 0; i < n; ) {
+			i += _write_batch(recs + i, n - i);
+			if (i < n) {
+				// A switch, which is never written
+				_cur = recs[i].split == -1 ? NULL : &_journals[recs[i].split];
+				++i;
+			}
+		}
+		mtx_lock(&_lock);
+	}
+
+	mtx_unlock(&_lock);
+
+	return 0;
+}
+
+int journal_open(int dirfd, size_t nids, bool *in_run) {
+	int fd = openat(dirfd, "journal", O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if (fd == -1) {
+		fputs("Warning: could not open journal\n", stderr);
+		return -1;
+	}
+
+	_journals = realloc(_journals, (_njournals + 1) * sizeof _journals[0]);
+	struct journal *j = &_journals[_njournals];
+
+	*j = (struct journal){
+		.fd = fd,
+		.dirfd = dirfd,
+		.run = {
+			.active_split = -1,
+			.nids = nids,
+			.cur = malloc(nids * sizeof j->run.cur[0]),
+		},
+	};
+	for (size_t i = 0; i < nids; ++i) {
+		j->run.cur[i] = UINT64_MAX;
+	}
+
+	struct journal_rec rec;
+	ssize_t n;
+	off_t good = 0;
+	while ((n = read(fd, &rec, sizeof rec)) == sizeof rec) {
+		// If adrift died just after a run finished, it may not have been
+		// written out yet
+		_apply(j, &rec, true);
+		good += sizeof rec;
+	}
+
+	// Drop a record torn by a crash, so later ones line up
+	if (n > 0) {
+		ftruncate(fd, good);
+	}
+
+	*in_run = j->run.in_run;
+
+	return _njournals++;
+}
+
+void journal_restore(struct state *s, int journal) {
+	const struct run *r = &_journals[journal].run;
+
+	for (size_t i = 0; i < r->nids; ++i) {
+		get_split_by_id(s, i)->split.times.cur = r->cur[i];
+	}
+	timer_resume(s, r->active_split, r->last_time, r->started);
+	fputs("Resumed run from journal\n", stderr);
+}
+
+bool journal_start(int journal) {
+	if (journal == -1) return false;
+
+	_cur = &_journals[journal];
+	_target = journal;
+	_closing = false;
+	mtx_init(&_lock, mtx_plain);
+	cnd_init(&_cnd);
+
+	if (thrd_create(&_thrd, _writer_main, NULL) != thrd_success) {
+		fputs("Warning: failed to start journal thread\n", stderr);
+		mtx_destroy(&_lock);
+		cnd_destroy(&_cnd);
+		return false;
+	}
+
+	_started = true;
+	return true;
+}
+
+static void _queue_rec(enum journal_type type, int split, uint64_t time) {
+	mtx_lock(&_lock);
+
+	if (_nqueue == _queue_alloc) {
+		_queue_alloc = _queue_alloc ? _queue_alloc * 2 : 64;
+		_queue = realloc(_queue, _queue_alloc * sizeof _queue[0]);
+	}
+
+	_queue[_nqueue++] = (struct journal_rec){
+		.type = type,
+		.split = split,
+		.time = time,
+	};
+
+	cnd_signal(&_cnd);
+	mtx_unlock(&_lock);
+}
+
+bool journal_append(enum journal_type type, int split, uint64_t time) {
+	if (!_started || _target == -1) return false;
+	_queue_rec(type, split, time);
+	return true;
+}
+
+void journal_switch(int journal) {
+	if (!_started) return;
+	// Records already queued still go to the old journal
+	_queue_rec(JOURNAL_SWITCH, journal, 0);
+	_target = journal;
+}
+
+void journal_write_run(int dirfd, struct state *s) {
+	struct journal j = {
+		.dirfd = dirfd,
+		.run = {
+			.finished = true,
+			.started = s->run_started,
+			.nids = s->nids,
+			.cur = malloc(s->nids * sizeof j.run.cur[0]),
+		},
+	};
+	for (size_t i = 0; i < s->nids; ++i) {
+		j.run.cur[i] = get_split_by_id(s, i)->split.times.cur;
+	}
+
+	struct split *final = get_final_split(s);
+	_write_run(&j, final->split.times.cur < final->split.times.pb, false);
+
+	free(j.run.cur);
+	free(j.prev_pb);
+}
+
+void journal_close(void) {
+	if (_started) {
+		mtx_lock(&_lock);
+		_closing = true;
+		cnd_signal(&_cnd);
+		mtx_unlock(&_lock);
+
+		thrd_join(_thrd, NULL);
+
+		mtx_destroy(&_lock);
+		cnd_destroy(&_cnd);
+		_started = false;
+	}
+
+	for (size_t i = 0; i < _njournals; ++i) {
+		close(_journals[i].fd);
+		free(_journals[i].run.cur);
+		free(_journals[i].prev_pb);
+	}
+	free(_journals);
+	_journals = NULL;
+	_njournals = 0;
+	_target = -1;
+
+	free(_queue);
+	free(_batch);
+	_queue = _batch = NULL;
+	_nqueue = _queue_alloc = _batch_alloc = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "common.h"
+
+// An append-only log of every change to the current run, so that a run
+// survives adrift or the machine dying. It's replayed on startup, and the
+// files in runs/ and the pb link are built from it on a separate thread
+
+enum journal_type {
+	JOURNAL_BEGIN = 1, // time is the wall clock time the run started
+	JOURNAL_SPLIT, // time is the split's cumulative time
+	JOURNAL_UNDO, // split is the split returned to; after a finish, the run is taken out of runs/
+	JOURNAL_SKIP, // split is the split skipped
+	JOURNAL_FINISH, // time is the final time; split is 1 if it's a PB
+	JOURNAL_RESET,
+	JOURNAL_LAYOUT, // The splits were reloaded; time is the new number of splits
+	JOURNAL_SWITCH, // Only queued, never written: split is the journal switched to
+};
+
+struct journal_rec {
+	uint8_t type;
+	uint8_t pad[3];
+	int32_t split;
+	uint64_t time;
+};
+
+// Open and replay the journal in a profile's directory, which has nids
+// splits. Sets in_run if it has a run in progress. Returns an index for the
+// journal, or -1 if it couldn't be opened
+int journal_open(int dirfd, size_t nids, bool *in_run);
+// Restore the run in progress in a journal to the state, which must have
+// that journal's profile loaded with its layout index built
+void journal_restore(struct state *s, int journal);
+// Start the writer thread, appending to the given journal
+bool journal_start(int journal);
+// Queue a record to be written. This never waits for the disk. Returns
+// false if there's no journal to write it to
+bool journal_append(enum journal_type type, int split, uint64_t time);
+// Append to another journal from now on, or to none if it's -1
+void journal_switch(int journal);
+// Write everything queued, stop the writer thread and close every journal
+void journal_close(void);
+// Write the state's finished run to runs/ in the profile directory dirfd
+// straight away, pointing pb at it if it's a PB, for when there's no
+// journal to do it
+void journal_write_run(int dirfd, struct state *s);
+
+#endif
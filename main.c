@@ -1,93 +1,57 @@
 #include <fcntl.h>
-#include <limits.h>
-#include <poll.h>
 #include <stdio.h>
 #include <stdbool.h>
-#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <unistd.h>
 
 #include "draw.h"
 #include "common.h"
+#include "export.h"
+#include "input.h"
 #include "io.h"
+#include "journal.h"
+#include "predict.h"
+#include "profile.h"
 #include "timer.h"
 
-static atomic_bool _g_should_exit;
-
-static vtk_window _g_win;
-
-static void int_handler(int signal) {
-	vtk_window_close(_g_win);
-}
-
-static void close_handler(vtk_event ev, void *u) {
-	vtk_window_close(_g_win);
-}
-
-static int input_main(void *u) {
-	struct state *s = u;
-
-	int pipefd[2];
-	if (pipe(pipefd) == -1) {
-		fputs("Failed to create pipe\n", stderr);
-		exit(1);
-	}
-
-	pid_t pid = 0;
-
-	pid = fork();
-	if (pid == 0) {
-		// Child
-		close(pipefd[0]);
-		dup2(pipefd[1], STDOUT_FILENO);
-		execlp("./splitter", "./splitter", NULL);
-		fputs("Failed to exec splitter\n", stderr);
-		exit(1);
-	} else if (pid == -1) {
-		fputs("Failed to fork\n", stderr);
-		exit(1);
-	}
+#define STATS_SUBSYS STATS_OTHER
+#include "stats.h"
 
-	// Parent
+// Profiles are loaded by up to this many threads at once
+#define MAX_LOADERS 4
 
-	close(pipefd[1]);
+// Seconds between lines of --stats, unless given
+#define STATS_INTERVAL 10
 
-	int fl = fcntl(pipefd[0], F_GETFL);
-	if (fl == -1) fl = 0;
-	fcntl(pipefd[0], F_SETFL, fl | O_NONBLOCK);
+static vtk_window _g_win;
 
-	FILE *f = fdopen(pipefd[0], "r");
+struct loader {
+	struct profile *profiles;
+	size_t nprofiles;
+	atomic_size_t next; // The next profile to be loaded
+	atomic_bool failed;
+};
 
-	struct pollfd fds[] = {
-		{ pipefd[0], POLLIN },
-	};
+static int _load_main(void *u) {
+	struct loader *l = u;
 
-	while (!_g_should_exit) {
-		// Use poll rather than getline directly; that way, we can routinely
-		// check if we should exit
-		if (poll(fds, sizeof fds / sizeof fds[0], 500) > 0) {
-			char *line = NULL;
-			size_t n = 0;
-			if (getline(&line, &n, f) == -1) {
-				free(line);
-				break;
-			}
-			line[strlen(line) - 1] = 0; // Remove newline
-			timer_parse(s, line);
-			free(line);
-			vtk_window_trigger_update(s->win);
-		}
+	size_t i;
+	while ((i = atomic_fetch_add(&l->next, 1)) < l->nprofiles) {
+		if (!profile_load(&l->profiles[i])) l->failed = true;
 	}
 
-	close(pipefd[0]);
+	return 0;
+}
 
-	if (pid) {
-		kill(pid, SIGINT);
-	}
+static void int_handler(int signal) {
+	vtk_window_close(_g_win);
+}
 
-	return 0;
+static void close_handler(vtk_event ev, void *u) {
+	vtk_window_close(_g_win);
 }
 
 void update_handler(vtk_event ev, void *u) {
@@ -96,46 +60,50 @@ void update_handler(vtk_event ev, void *u) {
 }
 
 int main(int argc, char **argv) {
-	if (argc > 2 || (argc == 2 && !strcmp(argv[1], "-h"))) {
-		fprintf(stderr, "Usage: %s [path]\n", argv[0]);
-		return argc > 2;
+	// This has to start before anything is allocated
+	if (argc > 1 && (!strcmp(argv[1], "--stats") || !strncmp(argv[1], "--stats=", 8))) {
+		stats_start(argv[1][7] ? atol(argv[1] + 8) : STATS_INTERVAL);
+		argv[1] = argv[0];
+		++argv;
+		--argc;
 	}
 
-	if (argc == 2) {
-		if (chdir(argv[1])) {
-			fprintf(stderr, "Failed to chdir to %s\n", argv[1]);
-			return 1;
-		}
+	if (argc == 2 && !strcmp(argv[1], "-h")) {
+		fprintf(stderr, "Usage: %s [--stats[=seconds]] [path...]\n", argv[0]);
+		return 0;
 	}
 
-	enum widget_type widgets[] = {
-		WIDGET_GAME_NAME,
-		WIDGET_CATEGORY_NAME,
-		WIDGET_SUM_OF_BEST,
-		WIDGET_BEST_POSSIBLE_TIME,
-		WIDGET_TIMER,
-		WIDGET_SPLIT_TIMER,
-		WIDGET_SPLITS,
-	};
+	startup_begin();
 
-	struct split *splits;
-	ssize_t nsplits = read_splits_file("splits", &splits);
+	// Each directory given is a profile, or the working directory is the
+	// only one
+	size_t nprofiles = argc > 1 ? argc - 1 : 1;
+	struct profile *profiles = calloc(nprofiles, sizeof profiles[0]);
 
-	if (nsplits == -1) {
-		return 1;
+	for (size_t i = 0; i < nprofiles; ++i) {
+		if (!profile_open(&profiles[i], argc > 1 ? argv[i + 1] : ".")) {
+			return 1;
+		}
 	}
 
-	if (!read_times(splits, nsplits, "pb", offsetof(struct times, pb))) {
-		fputs("Warning: could not read PB\n", stderr);
-	}
+	struct cfgdict *cfg = profiles[0].cfg;
 
-	if (!read_times(splits, nsplits, "golds", offsetof(struct times, best))) {
-		fputs("Warning: could not read golds\n", stderr);
-	}
+	startup_report(config_get_int(cfg, "report_startup", 0));
 
-	struct cfgdict *cfg = cfgdict_new();
-	if (!read_config("config", cfg)) {
-		fputs("Warning: could not read config\n", stderr);
+	// The splitter can be attaching to the game while everything else
+	// loads
+	input_start_splitter(cfg, profiles[0].dirfd);
+
+	// Parse the splits and times in the background while the window opens
+	struct loader loader = {
+		.profiles = profiles,
+		.nprofiles = nprofiles,
+	};
+	thrd_t loaders[MAX_LOADERS];
+	size_t nloaders = 0;
+	while (nloaders < nprofiles && nloaders < MAX_LOADERS) {
+		if (thrd_create(&loaders[nloaders], _load_main, &loader) != thrd_success) break;
+		++nloaders;
 	}
 
 	int err;
@@ -155,31 +123,109 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
+	// Help with any profiles left, then wait for the rest
+	_load_main(&loader);
+	for (size_t i = 0; i < nloaders; ++i) {
+		thrd_join(loaders[i], NULL);
+	}
+
+	if (loader.failed) {
+		vtk_window_destroy(win);
+		vtk_destroy(vtk);
+		return 1;
+	}
+
+	// Start in the first profile, unless another has a run to restore
+	size_t active = 0;
+	bool restore = false;
+
+	for (size_t i = 0; i < nprofiles; ++i) {
+		bool in_run;
+		profiles[i].journal = journal_open(profiles[i].dirfd, profiles[i].nids, &in_run);
+		if (in_run && !restore) {
+			active = i;
+			restore = true;
+		}
+	}
+
+	// The layout and splitter are the first profile's. The input thread
+	// moves to the active one once it has started the splitter
+	if (fchdir(profiles[0].dirfd)) {
+		fprintf(stderr, "Failed to chdir to %s\n", profiles[0].path);
+		vtk_window_destroy(win);
+		vtk_destroy(vtk);
+		return 1;
+	}
+
+	// Used if there's no layout file
+	static const enum widget_type default_widgets[] = {
+		WIDGET_GAME_NAME,
+		WIDGET_CATEGORY_NAME,
+		WIDGET_SUM_OF_BEST,
+		WIDGET_BEST_POSSIBLE_TIME,
+		WIDGET_TIMER,
+		WIDGET_SPLIT_TIMER,
+		WIDGET_SPLITS,
+	};
+
+	struct widget *widgets;
+	ssize_t nwidgets;
+
+	if (access("layout", F_OK) == 0) {
+		nwidgets = read_layout("layout", &widgets);
+		if (nwidgets == -1) {
+			vtk_window_destroy(win);
+			vtk_destroy(vtk);
+			return 1;
+		}
+	} else {
+		nwidgets = sizeof default_widgets / sizeof default_widgets[0];
+		widgets = calloc(nwidgets, sizeof widgets[0]);
+		for (ssize_t i = 0; i < nwidgets; ++i) {
+			widgets[i].type = default_widgets[i];
+		}
+	}
+
 	cairo_t *cr = vtk_window_get_cairo(win);
 
 	struct state s = {
 		.win = win,
 		.cr = cr,
 
-		.game_name = config_get_str(cfg, "game", "Portal 2"),
-		.category_name = config_get_str(cfg, "category", "Inbounds NoSLA"),
-
-		.nwidgets = sizeof widgets / sizeof widgets[0],
+		.nwidgets = nwidgets,
 		.widgets = widgets,
 
-		.nsplits = nsplits,
-		.splits = splits,
-
 		.active_split = -1,
 
 		.timer = 0,
 		.split_time = 0,
 
+		.nprofiles = nprofiles,
+		.profiles = profiles,
+		.profile = active,
+
 		.cfg = cfg,
 	};
 
+	profile_activate(&s, &profiles[active]);
+
+	if (restore) {
+		journal_restore(&s, profiles[active].journal);
+	}
+
+	journal_start(profiles[active].journal);
+
+	predict_start(&s);
+
+	export_start(&s);
+
+	mtx_init(&s.lock, mtx_plain);
+
 	_g_win = win;
 
+	// Writing to a splitter which has exited should fail, not kill adrift
+	signal(SIGPIPE, SIG_IGN);
+
 	thrd_t inp_thrd;
 	if (thrd_create(&inp_thrd, &input_main, &s) != thrd_success) {
 		fputs("Error creating thread\n", stderr);
@@ -196,16 +242,32 @@ int main(int argc, char **argv) {
 
 	vtk_window_mainloop(win);
 
+	draw_free();
+
 	vtk_window_destroy(win);
 	vtk_destroy(vtk);
 
-	_g_should_exit = true;
+	input_stop();
 
 	thrd_join(inp_thrd, NULL);
 
-	save_times(splits, nsplits, "golds", offsetof(struct times, best));
+	predict_stop();
+
+	export_stop();
+
+	journal_close();
+
+	profile_deactivate(&s, &profiles[s.profile]);
+	for (size_t i = 0; i < nprofiles; ++i) {
+		profile_free(&profiles[i]);
+	}
+	free(profiles);
+
+	mtx_destroy(&s.lock);
+
+	free_widgets(widgets, nwidgets);
 
-	cfgdict_free(cfg);
+	stats_stop();
 
 	return 0;
 }
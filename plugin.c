@@ -0,0 +1,232 @@
+#include "plugin.h"
+#include "input.h"
+#include "timer.h"
+#include "splitters/rift_plugin.h"
+#include <dlfcn.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// How long after failing the plugin is restarted, doubling each time it
+// fails again soon after, up to the max, as for the splitter process
+#define RESTART_MIN_MS 250
+#define RESTART_MAX_MS 30000
+// A plugin which ran at least this long is restarted straight away
+#define RESTART_STABLE_MS 10000
+
+static void *_dl;
+static const struct rift_plugin *_plugin;
+static void *_inst;
+static struct rift_host _host;
+
+static thrd_t _thrd;
+static atomic_bool _should_exit;
+static int _wake_fd = -1;
+
+// Whether a failed plugin is restarted, from splitter_restart
+static bool _restart;
+
+// Whether the plugin changed anything drawn during the current update
+static bool _emitted;
+
+// Whether a run is in progress, as last set by the input thread or when
+// the plugin started, and as last passed to the plugin; -1 if not yet
+static atomic_int _active = -1;
+static int _told_active = -1;
+
+static const enum timer_event _events[] = {
+	[RIFT_EV_TIME] = TIMER_EV_NONE,
+	[RIFT_EV_BEGIN] = TIMER_EV_BEGIN,
+	[RIFT_EV_SPLIT] = TIMER_EV_SPLIT,
+	[RIFT_EV_RESET] = TIMER_EV_RESET,
+	[RIFT_EV_PAUSE] = TIMER_EV_PAUSE,
+	[RIFT_EV_RESUME] = TIMER_EV_RESUME,
+};
+
+static void _emit(void *ctx, enum rift_event ev, uint64_t usec) {
+	struct state *s = ctx;
+
+	if ((unsigned)ev >= sizeof _events / sizeof _events[0]) {
+		return;
+	}
+
+	startup_mark(STARTUP_SPLITTER_ATTACHED);
+
+	mtx_lock(&s->lock);
+	struct view before = get_view(s);
+	timer_event(s, _events[ev], usec);
+	struct view after = get_view(s);
+	if (!view_eq(&before, &after)) _emitted = true;
+	mtx_unlock(&s->lock);
+}
+
+// Wait up to timeout milliseconds, or until woken
+static void _wait(int timeout) {
+	struct pollfd pfd = { .fd = _wake_fd, .events = POLLIN };
+	if (poll(&pfd, 1, timeout) > 0) {
+		uint64_t val;
+		read(_wake_fd, &val, sizeof val);
+	}
+}
+
+// How long to wait before starting the plugin again after it failed,
+// having been started at started, or -1 if it's not to be restarted
+static int _restart_delay(uint64_t started, unsigned *restart_delay_ms) {
+	if (!_restart) return -1;
+
+	if (get_mono_us() - started >= RESTART_STABLE_MS * 1000ull) *restart_delay_ms = 0;
+
+	unsigned delay = *restart_delay_ms;
+	*restart_delay_ms = delay == 0 ? RESTART_MIN_MS : delay * 2 < RESTART_MAX_MS ? delay * 2 : RESTART_MAX_MS;
+
+	if (delay) fprintf(stderr, "Restarting splitter plugin in %ums\n", delay);
+	return delay;
+}
+
+static int _plugin_main(void *u) {
+	struct state *s = u;
+	uint64_t started = get_mono_us(), restart_at = 0;
+	unsigned restart_delay_ms = 0;
+
+	while (!_should_exit) {
+		int delay;
+
+		if (!_inst) {
+			// Being woken, such as when a run starts, doesn't cut the wait short
+			int64_t left = (int64_t)(restart_at - get_mono_us()) / 1000;
+			if (left > 0) {
+				_wait(left);
+				continue;
+			}
+
+			started = get_mono_us();
+			_inst = _plugin->init(&_host);
+			if (!_inst) {
+				fputs("Failed to initialize splitter plugin\n", stderr);
+				if ((delay = _restart_delay(started, &restart_delay_ms)) < 0) break;
+				restart_at = get_mono_us() + delay * 1000ull;
+				continue;
+			}
+
+			// The new instance resets when it attaches, which mustn't end
+			// the run, and needs telling whether there is one
+			mtx_lock(&s->lock);
+			s->resumed = s->active_split != -1;
+			mtx_unlock(&s->lock);
+			_told_active = -1;
+		}
+
+		int active = _active;
+		if (active != -1 && active != _told_active && _plugin->abi_version >= 2 && _plugin->set_active) {
+			_plugin->set_active(_inst, active);
+			_told_active = active;
+		}
+
+		_emitted = false;
+		delay = _plugin->update(_inst);
+
+		// Only wake the window once for everything emitted in an update
+		if (_emitted) {
+			vtk_window_trigger_update(s->win);
+			input_notify();
+		}
+
+		if (delay < 0) {
+			fputs("Splitter plugin failed\n", stderr);
+			_plugin->shutdown(_inst);
+			_inst = NULL;
+			if ((delay = _restart_delay(started, &restart_delay_ms)) < 0) break;
+			restart_at = get_mono_us() + delay * 1000ull;
+			continue;
+		}
+
+		_wait(delay);
+	}
+
+	return 0;
+}
+
+bool plugin_start(struct state *s, const char *path) {
+	_dl = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!_dl) {
+		fprintf(stderr, "Failed to load splitter plugin: %s\n", dlerror());
+		return false;
+	}
+
+	rift_plugin_entry_fn entry = (rift_plugin_entry_fn)dlsym(_dl, RIFT_PLUGIN_ENTRY);
+	_plugin = entry ? entry() : NULL;
+
+	if (!_plugin) {
+		fprintf(stderr, "%s is not a splitter plugin\n", path);
+		goto err;
+	}
+
+	// Later versions only add fields, so older plugins still work
+	if (_plugin->abi_version < 1 || _plugin->abi_version > RIFT_PLUGIN_ABI_VERSION) {
+		fprintf(stderr, "Splitter plugin %s has ABI version %u, expected at most %u\n", path, _plugin->abi_version, RIFT_PLUGIN_ABI_VERSION);
+		goto err;
+	}
+
+	_restart = config_get_int(s->cfg, "splitter_restart", 1);
+
+	_host = (struct rift_host){
+		.ctx = s,
+		.emit = _emit,
+	};
+
+	_inst = _plugin->init(&_host);
+	if (!_inst) {
+		fputs("Failed to initialize splitter plugin\n", stderr);
+		goto err;
+	}
+
+	// So the plugin is told before its first update, even if a run
+	// restored from the journal is already in progress
+	mtx_lock(&s->lock);
+	_active = s->active_split != -1;
+	mtx_unlock(&s->lock);
+
+	_wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (_wake_fd == -1 || thrd_create(&_thrd, &_plugin_main, s) != thrd_success) {
+		fputs("Error creating plugin thread\n", stderr);
+		_plugin->shutdown(_inst);
+		if (_wake_fd != -1) close(_wake_fd);
+		_wake_fd = -1;
+		goto err;
+	}
+
+	return true;
+
+err:
+	dlclose(_dl);
+	_dl = NULL;
+	_plugin = NULL;
+	return false;
+}
+
+void plugin_set_active(bool active) {
+	if (!_plugin || _active == active) return;
+
+	_active = active;
+	uint64_t one = 1;
+	write(_wake_fd, &one, sizeof one);
+}
+
+void plugin_stop(void) {
+	if (!_plugin) return;
+
+	_should_exit = true;
+	uint64_t one = 1;
+	write(_wake_fd, &one, sizeof one);
+	thrd_join(_thrd, NULL);
+
+	// Gone already if it failed and wasn't restarted
+	if (_inst) _plugin->shutdown(_inst);
+	close(_wake_fd);
+	dlclose(_dl);
+
+	_plugin = NULL;
+	_dl = NULL;
+}
@@ -0,0 +1,14 @@
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include "common.h"
+
+// Load a splitter plugin from the given shared object and run it on its
+// own thread, with its events applied directly to the timer. Returns
+// false if the plugin could not be loaded
+bool plugin_start(struct state *s, const char *path);
+// Tell the plugin whether a run is in progress
+void plugin_set_active(bool active);
+void plugin_stop(void);
+
+#endif
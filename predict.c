@@ -0,0 +1,520 @@
+#include "predict.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STATS_SUBSYS STATS_TIMER
+#include "stats.h"
+
+#define RUNS_DIR "runs"
+#define PREDICT_SAMPLES 2048
+// Once split_time is past some samples, the prediction grows along with
+// it, but it's only shown to a tenth of a second
+#define PREDICT_STEP_US 100000
+
+// How far the run has got, which is what a prediction is made from
+struct request {
+	// The splits the history is for; if any of these change, it has to be
+	// loaded again
+	const struct split *tree;
+	int dirfd;
+	size_t nids;
+
+	// Splits before from are done. Those from from up to and including
+	// active have taken split_time so far between them, since prev_time.
+	// Both are nids once the run has finished
+	size_t from, active;
+	uint64_t prev_time, split_time;
+	uint64_t pb;
+};
+
+// A split's segment times from past runs, kept sorted, so a uniformly
+// random index into them is a sample from their distribution
+struct samples {
+	uint64_t *t;
+	size_t n, alloc;
+};
+
+static thrd_t _thrd;
+static mtx_t _lock;
+static cnd_t _cnd;
+static bool _running, _closing;
+static vtk_window _win;
+
+// The latest request and the data handed over with it, under _lock. best
+// is the golds when the history must be loaded again, and run the times
+// of a run which just finished, to be added to it
+static bool _pending;
+static struct request _req;
+static uint64_t *_req_best, *_req_run;
+
+// The split_time at which the prediction for the latest request would
+// next change, or UINT64_MAX if it won't, or the request hasn't been
+// handled yet. Set under _lock, and read by the input thread without it
+static _Atomic uint64_t _next_split_time = UINT64_MAX;
+
+// Input thread only
+static struct request _last;
+static time_t _last_run_started;
+
+// Worker thread only
+static struct samples *_hist;
+static size_t _hist_nids;
+static uint64_t _finish[PREDICT_SAMPLES];
+static uint64_t _rng[4], _seed_rng[4];
+static struct prediction _prev;
+
+// The published prediction, guarded by a sequence number which is odd
+// while it's being written, so readers retry rather than wait
+static atomic_uint _seq;
+static _Atomic uint64_t _pub_finish = UINT64_MAX, _pub_save = UINT64_MAX, _pub_chance = UINT64_MAX;
+
+static void _publish(const struct prediction *p) {
+	unsigned seq = atomic_load_explicit(&_seq, memory_order_relaxed);
+	atomic_store_explicit(&_seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	atomic_store_explicit(&_pub_finish, p->finish, memory_order_relaxed);
+	atomic_store_explicit(&_pub_save, p->save, memory_order_relaxed);
+	atomic_store_explicit(&_pub_chance, p->chance_ppm, memory_order_relaxed);
+
+	atomic_store_explicit(&_seq, seq + 2, memory_order_release);
+}
+
+struct prediction predict_get(void) {
+	struct prediction p;
+	unsigned before, after;
+
+	do {
+		before = atomic_load_explicit(&_seq, memory_order_acquire);
+		p.finish = atomic_load_explicit(&_pub_finish, memory_order_relaxed);
+		p.save = atomic_load_explicit(&_pub_save, memory_order_relaxed);
+		p.chance_ppm = atomic_load_explicit(&_pub_chance, memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&_seq, memory_order_relaxed);
+	} while ((before & 1) || before != after);
+
+	return p;
+}
+
+// xoshiro256**
+static uint64_t _rotl(uint64_t x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t _next(void) {
+	uint64_t result = _rotl(_rng[1] * 5, 7) * 9;
+	uint64_t t = _rng[1] << 17;
+
+	_rng[2] ^= _rng[0];
+	_rng[3] ^= _rng[1];
+	_rng[1] ^= _rng[2];
+	_rng[0] ^= _rng[3];
+	_rng[2] ^= t;
+	_rng[3] = _rotl(_rng[3], 45);
+
+	return result;
+}
+
+// A random index below n, which is far less than 2^32
+static size_t _below(size_t n) {
+	return (_next() >> 32) * n >> 32;
+}
+
+static void _seed(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t x = (uint64_t)time(NULL) ^ ((uint64_t)ts.tv_nsec << 20);
+
+	// splitmix64, so the state is never all zero
+	for (int i = 0; i < 4; ++i) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		_seed_rng[i] = z ^ (z >> 31);
+	}
+}
+
+static void _push(struct samples *sm, uint64_t t) {
+	if (sm->n == sm->alloc) {
+		sm->alloc = sm->alloc ? sm->alloc * 2 : 16;
+		sm->t = realloc(sm->t, sm->alloc * sizeof sm->t[0]);
+	}
+	sm->t[sm->n++] = t;
+}
+
+// The number of sorted times less than t
+static size_t _count_below(const uint64_t *times, size_t n, uint64_t t) {
+	size_t lo = 0, hi = n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (times[mid] < t) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+static int _time_cmp(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+// Add the segments of a run, given as cumulative times. A segment after a
+// skipped split covers more than one split, so it's left out
+static void _add_run(const uint64_t *cur) {
+	for (size_t i = 0; i < _hist_nids; ++i) {
+		uint64_t prev = i ? cur[i - 1] : 0;
+		if (cur[i] == UINT64_MAX || prev == UINT64_MAX || cur[i] < prev) continue;
+		_push(&_hist[i], cur[i] - prev);
+	}
+}
+
+static void _sort_history(void) {
+	for (size_t i = 0; i < _hist_nids; ++i) {
+		qsort(_hist[i].t, _hist[i].n, sizeof _hist[i].t[0], _time_cmp);
+	}
+}
+
+static void _free_history(void) {
+	for (size_t i = 0; i < _hist_nids; ++i) {
+		free(_hist[i].t);
+	}
+	free(_hist);
+	_hist = NULL;
+	_hist_nids = 0;
+}
+
+// Read a run file, as the journal writes them. Returns false if it's
+// unreadable or doesn't have one line per split, as for runs from before
+// the splits were changed
+static bool _read_run(int dfd, const char *name, uint64_t *cur, size_t nids) {
+	int fd = openat(dfd, name, O_RDONLY | O_CLOEXEC);
+	FILE *f = fd == -1 ? NULL : fdopen(fd, "r");
+	if (!f) {
+		if (fd != -1) close(fd);
+		return false;
+	}
+
+	char line[32];
+	size_t n = 0;
+	bool ok = true;
+
+	while (ok && fgets(line, sizeof line, f)) {
+		if (n == nids) {
+			ok = false;
+		} else if (line[0] == '-') {
+			cur[n++] = UINT64_MAX;
+		} else {
+			char *end;
+			cur[n++] = strtoull(line, &end, 10);
+			ok = end != line;
+		}
+	}
+
+	fclose(f);
+	return ok && n == nids;
+}
+
+static void _load_history(int dfd, size_t nids, const uint64_t *best) {
+	_free_history();
+	_hist = calloc(nids, sizeof _hist[0]);
+	_hist_nids = nids;
+
+	uint64_t *cur = malloc(nids * sizeof cur[0]);
+
+	int fd = openat(dfd, RUNS_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR *d = fd == -1 ? NULL : fdopendir(fd);
+	if (d) {
+		struct dirent *de;
+		while ((de = readdir(d))) {
+			if (de->d_name[0] == '.') continue;
+			if (_read_run(fd, de->d_name, cur, nids)) _add_run(cur);
+		}
+		closedir(d);
+	} else if (fd != -1) {
+		close(fd);
+	}
+
+	free(cur);
+
+	// A split which hasn't been done in any run kept is assumed to take
+	// its gold
+	for (size_t i = 0; i < nids; ++i) {
+		if (!_hist[i].n && best[i] != UINT64_MAX) _push(&_hist[i], best[i]);
+	}
+
+	_sort_history();
+}
+
+// Also sets *next to the split_time at which the prediction would change
+static struct prediction _predict(const struct request *rq, uint64_t *next) {
+	struct prediction p = { UINT64_MAX, UINT64_MAX, UINT64_MAX };
+
+	*next = UINT64_MAX;
+
+	if (rq->nids != _hist_nids) return p;
+
+	for (size_t i = rq->from; i < rq->nids; ++i) {
+		if (!_hist[i].n) return p;
+	}
+
+	// The splits which have already been started, and which have to take
+	// at least as long as they have so far
+	size_t started_end = rq->active < rq->nids ? rq->active + 1 : rq->nids;
+
+	// If only the active split has been started, only the times which are
+	// at least split_time can still happen. Otherwise the total is just
+	// held to split_time
+	size_t active_lo = 0;
+	if (rq->from == rq->active && rq->active < rq->nids) {
+		const struct samples *sm = &_hist[rq->active];
+		active_lo = _count_below(sm->t, sm->n, rq->split_time);
+		// Passing the next sample rules it out
+		if (active_lo < sm->n) *next = sm->t[active_lo] + 1;
+	}
+
+	// Whether any sample was held to split_time, so moves with it
+	bool held = false;
+
+	// Every prediction uses the same random numbers, so that the figures
+	// only move as the run does, rather than jittering from frame to frame
+	memcpy(_rng, _seed_rng, sizeof _rng);
+
+	for (size_t k = 0; k < PREDICT_SAMPLES; ++k) {
+		uint64_t seg = 0;
+		for (size_t i = rq->from; i < started_end; ++i) {
+			const struct samples *sm = &_hist[i];
+			size_t lo = i == rq->active ? active_lo : 0;
+			if (lo == sm->n) held = true;
+			seg += lo == sm->n ? rq->split_time : sm->t[lo + _below(sm->n - lo)];
+		}
+		if (seg < rq->split_time) {
+			seg = rq->split_time;
+			held = true;
+		} else if (seg + 1 < *next) {
+			// Until split_time passes this sample, which then gets held
+			*next = seg + 1;
+		}
+
+		uint64_t t = rq->prev_time + seg;
+		for (size_t i = started_end; i < rq->nids; ++i) {
+			const struct samples *sm = &_hist[i];
+			t += sm->t[_below(sm->n)];
+		}
+
+		_finish[k] = t;
+	}
+
+	if (held) *next = rq->split_time + PREDICT_STEP_US;
+
+	qsort(_finish, PREDICT_SAMPLES, sizeof _finish[0], _time_cmp);
+
+	p.finish = _finish[PREDICT_SAMPLES / 2];
+
+	if (rq->pb != UINT64_MAX) {
+		size_t npb = _count_below(_finish, PREDICT_SAMPLES, rq->pb);
+		p.chance_ppm = (uint64_t)npb * 1000000 / PREDICT_SAMPLES;
+		if (npb) p.save = rq->pb - _finish[npb / 2];
+	}
+
+	return p;
+}
+
+static int _worker_main(void *u) {
+	mtx_lock(&_lock);
+
+	while (true) {
+		while (!_pending && !_closing) {
+			cnd_wait(&_cnd, &_lock);
+		}
+
+		if (_closing) break;
+
+		struct request rq = _req;
+		uint64_t *best = _req_best, *run = _req_run;
+		_req_best = _req_run = NULL;
+		_pending = false;
+
+		mtx_unlock(&_lock);
+
+		if (best) {
+			_load_history(rq.dirfd, rq.nids, best);
+			free(best);
+		}
+
+		if (run) {
+			_add_run(run);
+			_sort_history();
+			free(run);
+		}
+
+		uint64_t next;
+		struct prediction p = _predict(&rq, &next);
+		_publish(&p);
+
+		// The timer is redrawn every frame while it runs anyway, so this
+		// only matters when the run isn't going
+		if (p.finish != _prev.finish || p.save != _prev.save || p.chance_ppm != _prev.chance_ppm) {
+			vtk_window_trigger_update(_win);
+		}
+		_prev = p;
+
+		mtx_lock(&_lock);
+
+		// Unless it's already out of date
+		if (!_pending) atomic_store_explicit(&_next_split_time, next, memory_order_relaxed);
+	}
+
+	mtx_unlock(&_lock);
+
+	return 0;
+}
+
+static bool _req_eq(const struct request *a, const struct request *b) {
+	return a->tree == b->tree && a->dirfd == b->dirfd && a->nids == b->nids && a->from == b->from && a->active == b->active && a->prev_time == b->prev_time && a->pb == b->pb;
+}
+
+void predict_start(struct state *s) {
+	bool wanted = false;
+	for (size_t i = 0; i < s->nwidgets; ++i) {
+		switch (s->widgets[i].type) {
+		case WIDGET_PB_CHANCE:
+		case WIDGET_PREDICTED_FINISH:
+		case WIDGET_TIME_SAVE:
+			wanted = true;
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (!wanted) return;
+
+	_seed();
+	_win = s->win;
+	_closing = false;
+	_pending = false;
+	_last = (struct request){ 0 };
+	_next_split_time = UINT64_MAX;
+	mtx_init(&_lock, mtx_plain);
+	cnd_init(&_cnd);
+
+	if (thrd_create(&_thrd, _worker_main, NULL) != thrd_success) {
+		fputs("Warning: failed to start prediction thread\n", stderr);
+		mtx_destroy(&_lock);
+		cnd_destroy(&_cnd);
+		return;
+	}
+
+	_running = true;
+
+	// Predict the whole run straight away, rather than once something
+	// happens
+	predict_request(s);
+}
+
+void predict_request(struct state *s) {
+	if (!_running) return;
+
+	struct split *final = get_final_split(s);
+
+	struct request rq = {
+		.tree = s->splits,
+		.dirfd = s->profiles[s->profile].dirfd,
+		.nids = s->nids,
+		.pb = final->split.times.pb,
+	};
+
+	bool finished = s->active_split == -1 && final->split.times.cur != UINT64_MAX;
+
+	if (finished) {
+		rq.from = rq.active = s->nids;
+		rq.prev_time = final->split.times.cur;
+	} else if (s->active_split != -1) {
+		rq.active = s->active_split;
+		rq.from = rq.active;
+		while (rq.from > 0 && get_split_by_id(s, rq.from - 1)->split.times.cur == UINT64_MAX) {
+			--rq.from;
+		}
+		rq.prev_time = get_prev_cur(s, rq.active);
+		rq.split_time = s->split_time;
+	}
+
+	bool reload = rq.tree != _last.tree || rq.dirfd != _last.dirfd || rq.nids != _last.nids;
+	bool new_run = finished && s->run_started != _last_run_started;
+	if (new_run) {
+		_last_run_started = s->run_started;
+		// Its file is loaded with the rest, as the journal wrote it out
+		// when it was restored
+		if (reload) new_run = false;
+	}
+
+	// The time into the split only matters once it passes the point where
+	// the prediction changes, not every frame
+	bool moved = rq.split_time >= atomic_load_explicit(&_next_split_time, memory_order_relaxed);
+	if (!reload && !new_run && !moved && _req_eq(&rq, &_last)) return;
+
+	uint64_t *best = NULL, *run = NULL;
+
+	if (reload) {
+		best = malloc(s->nids * sizeof best[0]);
+		for (size_t i = 0; i < s->nids; ++i) {
+			best[i] = get_split_by_id(s, i)->split.times.best;
+		}
+	}
+
+	if (new_run) {
+		run = malloc(s->nids * sizeof run[0]);
+		for (size_t i = 0; i < s->nids; ++i) {
+			run[i] = get_split_by_id(s, i)->split.times.cur;
+		}
+	}
+
+	mtx_lock(&_lock);
+
+	_req = rq;
+	if (best) {
+		// A run not yet added is in the history being loaded, or from the
+		// old splits
+		free(_req_best);
+		free(_req_run);
+		_req_best = best;
+		_req_run = NULL;
+	}
+	if (run) {
+		free(_req_run);
+		_req_run = run;
+	}
+	_pending = true;
+	atomic_store_explicit(&_next_split_time, UINT64_MAX, memory_order_relaxed);
+
+	cnd_signal(&_cnd);
+	mtx_unlock(&_lock);
+
+	_last = rq;
+}
+
+void predict_stop(void) {
+	if (!_running) return;
+
+	mtx_lock(&_lock);
+	_closing = true;
+	cnd_signal(&_cnd);
+	mtx_unlock(&_lock);
+
+	thrd_join(_thrd, NULL);
+
+	mtx_destroy(&_lock);
+	cnd_destroy(&_cnd);
+
+	free(_req_best);
+	free(_req_run);
+	_req_best = _req_run = NULL;
+	_free_history();
+	_running = false;
+}
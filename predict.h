@@ -0,0 +1,27 @@
+#ifndef PREDICT_H
+#define PREDICT_H
+
+#include "common.h"
+
+// Predictions of how the run will end, made by sampling each remaining
+// split's times from past runs in runs/, given how far the run has got.
+// They're made on a worker thread, and can be read at any time without
+// locking
+
+struct prediction {
+	// Each UINT64_MAX if it can't be predicted
+	uint64_t finish; // The median finishing time
+	uint64_t save; // How much a PB would most likely beat the PB by
+	uint64_t chance_ppm; // Chance of a PB, in parts per million
+};
+
+// Start the worker thread, if any widget shows a prediction
+void predict_start(struct state *s);
+// Ask for a new prediction if the run has moved on. Must be called with
+// the state locked
+void predict_request(struct state *s);
+// Get the latest prediction
+struct prediction predict_get(void);
+void predict_stop(void);
+
+#endif
@@ -0,0 +1,173 @@
+#include "profile.h"
+#include "io.h"
+#include "journal.h"
+#include "reload.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STATS_SUBSYS STATS_IO
+#include "stats.h"
+
+// The path of a file in a profile's directory, to be freed
+static char *_path(struct profile *p, const char *name) {
+	char *path = malloc(strlen(p->path) + strlen(name) + 2);
+	sprintf(path, "%s/%s", p->path, name);
+	return path;
+}
+
+bool profile_open(struct profile *p, const char *path) {
+	*p = (struct profile){
+		.path = strdup(path),
+		.journal = -1,
+		.pb_store = STORE_INIT,
+		.golds_store = STORE_INIT,
+	};
+
+	p->dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (p->dirfd == -1) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		return false;
+	}
+
+	p->cfg = cfgdict_new();
+	char *cfg_path = _path(p, "config");
+	if (!read_config(cfg_path, p->cfg)) {
+		fprintf(stderr, "Warning: could not read config for %s\n", path);
+	}
+	free(cfg_path);
+
+	p->game_name = config_get_str(p->cfg, "game", "Portal 2");
+	p->category_name = config_get_str(p->cfg, "category", "Inbounds NoSLA");
+
+	return true;
+}
+
+bool profile_load(struct profile *p) {
+	char *splits_path = _path(p, "splits");
+	ssize_t nsplits = read_splits_file(splits_path, &p->splits);
+	free(splits_path);
+	if (nsplits == -1) {
+		return false;
+	}
+	p->nsplits = nsplits;
+
+	size_t nids = get_split_id(&p->splits[nsplits - 1]) + 1;
+
+	char *pb_path = _path(p, "pb"), *pb_bin_path = _path(p, "pb.bin");
+	if (!load_times(p->splits, p->nsplits, nids, &p->pb_store, pb_path, pb_bin_path, offsetof(struct times, pb))) {
+		fprintf(stderr, "Warning: could not read PB for %s\n", p->path);
+	}
+	free(pb_path);
+	free(pb_bin_path);
+
+	char *golds_path = _path(p, "golds"), *golds_bin_path = _path(p, "golds.bin");
+	if (!load_times(p->splits, p->nsplits, nids, &p->golds_store, golds_path, golds_bin_path, offsetof(struct times, best))) {
+		fprintf(stderr, "Warning: could not read golds for %s\n", p->path);
+	}
+	free(golds_path);
+	free(golds_bin_path);
+
+	// Build the layout index now, so activating the profile needn't
+	struct state tmp = {
+		.splits = p->splits,
+		.nsplits = p->nsplits,
+		.active_split = -1,
+	};
+	layout_splits(&tmp);
+
+	p->nrows = tmp.nrows;
+	p->rows = tmp.rows;
+	p->active_row = tmp.active_row;
+	p->nids = tmp.nids;
+	p->by_id = tmp.by_id;
+
+	return true;
+}
+
+void profile_activate(struct state *s, struct profile *p) {
+	s->game_name = p->game_name;
+	s->category_name = p->category_name;
+	s->nsplits = p->nsplits;
+	s->splits = p->splits;
+	s->nrows = p->nrows;
+	s->rows = p->rows;
+	s->active_row = p->active_row;
+	s->nids = p->nids;
+	s->by_id = p->by_id;
+	s->pb_store = p->pb_store;
+	s->golds_store = p->golds_store;
+}
+
+void profile_deactivate(struct state *s, struct profile *p) {
+	// The splits may have been reloaded while it was active
+	p->nsplits = s->nsplits;
+	p->splits = s->splits;
+	p->nrows = s->nrows;
+	p->rows = s->rows;
+	p->active_row = s->active_row;
+	p->nids = s->nids;
+	p->by_id = s->by_id;
+	p->pb_store = s->pb_store;
+	p->golds_store = s->golds_store;
+}
+
+bool profile_switch(struct state *s, size_t idx) {
+	if (idx >= s->nprofiles) {
+		fprintf(stderr, "Warning: no profile %zu\n", idx);
+		return false;
+	}
+
+	if (idx == s->profile) return true;
+
+	// A run's times belong to its profile
+	if (s->active_split != -1 || get_final_split(s)->split.times.cur != UINT64_MAX) {
+		fputs("Warning: can't switch profile during a run\n", stderr);
+		return false;
+	}
+
+	struct profile *p = &s->profiles[idx];
+
+	// Times files and the splits file are found relative to the active
+	// profile; the journal uses the directory directly
+	if (fchdir(p->dirfd)) {
+		fprintf(stderr, "Warning: failed to chdir to %s\n", p->path);
+		return false;
+	}
+
+	profile_deactivate(s, &s->profiles[s->profile]);
+	profile_activate(s, p);
+	s->profile = idx;
+	s->static_gen++;
+
+	journal_switch(p->journal);
+	reload_switch();
+
+	return true;
+}
+
+void profile_free(struct profile *p) {
+	if (p->dirfd != -1 && p->splits && fchdir(p->dirfd) == 0) {
+		// Keep the text file up to date for anything else which reads it,
+		// then mark the store as newer, so it's still what's loaded next
+		// time
+		save_times(p->splits, p->nsplits, "golds", offsetof(struct times, best));
+		store_sync(&p->golds_store, SIZE_MAX);
+	}
+
+	store_close(&p->golds_store);
+	store_close(&p->pb_store);
+
+	free(p->rows);
+	free(p->by_id);
+	if (p->splits) {
+		free_splits(p->splits, p->nsplits);
+		free(p->splits);
+	}
+
+	if (p->cfg) config_free(p->cfg);
+	if (p->dirfd != -1) close(p->dirfd);
+	free(p->path);
+}
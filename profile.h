@@ -0,0 +1,23 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "common.h"
+
+// Open the profile in the directory at path and read its config, which is
+// all that's needed to start the splitter and open the window
+bool profile_open(struct profile *p, const char *path);
+// Read an opened profile's splits and times, and build its layout index.
+// Paths are relative to the working directory as when it was opened,
+// which isn't changed, so several profiles can be loaded at once on
+// different threads. Returns false if its splits couldn't be read
+bool profile_load(struct profile *p);
+// Move a profile's data into the state, or back out of it
+void profile_activate(struct state *s, struct profile *p);
+void profile_deactivate(struct state *s, struct profile *p);
+// Make another profile active. Only allowed between runs. Must be called
+// with the state locked, from the input thread
+bool profile_switch(struct state *s, size_t idx);
+// Save a profile's golds and free it. It mustn't be active
+void profile_free(struct profile *p);
+
+#endif
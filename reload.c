@@ -0,0 +1,134 @@
+#include "reload.h"
+#include "io.h"
+#include "journal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define STATS_SUBSYS STATS_IO
+#include "stats.h"
+
+#define SPLITS_PATH "splits"
+
+static int _fd = -1;
+static int _wd = -1;
+
+// Parsed and waiting to be swapped in
+static struct split *_pending;
+static size_t _npending;
+
+static void _free_tree(struct split *splits, size_t nsplits) {
+	free_splits(splits, nsplits);
+	free(splits);
+}
+
+int reload_watch(void) {
+	_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (_fd == -1) return -1;
+
+	// Watch the directory rather than the file, since editors often write
+	// a new file and rename it over the old one
+	_wd = inotify_add_watch(_fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (_wd == -1) {
+		close(_fd);
+		_fd = -1;
+	}
+
+	return _fd;
+}
+
+bool reload_check(void) {
+	// Aligned for the events in it
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	bool changed = false;
+	ssize_t n;
+
+	while ((n = read(_fd, u.buf, sizeof u.buf)) > 0) {
+		for (char *p = u.buf; p < u.buf + n; ) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+			if (ev->len && !strcmp(ev->name, SPLITS_PATH)) changed = true;
+			p += sizeof *ev + ev->len;
+		}
+	}
+
+	return changed;
+}
+
+void reload_parse(void) {
+	struct split *splits;
+	ssize_t nsplits = read_splits_file(SPLITS_PATH, &splits);
+
+	// Keep what's there if the file is half-written or broken; it'll be
+	// tried again when it next changes
+	if (nsplits <= 0) {
+		fputs("Warning: not reloading splits\n", stderr);
+		return;
+	}
+
+	if (_pending) _free_tree(_pending, _npending);
+	_pending = splits;
+	_npending = nsplits;
+}
+
+bool reload_apply(struct state *s) {
+	if (!_pending) return false;
+
+	// Wait for the run to be reset, so its times aren't lost
+	if (s->active_split != -1 || get_final_split(s)->split.times.cur != UINT64_MAX) return false;
+
+	size_t carried = carry_times(s->splits, s->nsplits, _pending, _npending);
+
+	free_layout(s);
+	_free_tree(s->splits, s->nsplits);
+
+	s->splits = _pending;
+	s->nsplits = _npending;
+	_pending = NULL;
+
+	layout_splits(s);
+	s->static_gen++;
+
+	// Slots are by id, so the stores are rebuilt for the new splits
+	store_close(&s->pb_store);
+	store_close(&s->golds_store);
+	create_store(s->splits, s->nsplits, s->nids, &s->pb_store, "pb.bin", offsetof(struct times, pb));
+	create_store(s->splits, s->nsplits, s->nids, &s->golds_store, "golds.bin", offsetof(struct times, best));
+
+	journal_append(JOURNAL_LAYOUT, 0, s->nids);
+
+	fprintf(stderr, "Reloaded splits, keeping times for %zu of %zu\n", carried, s->nids);
+
+	return true;
+}
+
+void reload_switch(void) {
+	if (_pending) {
+		_free_tree(_pending, _npending);
+		_pending = NULL;
+	}
+
+	if (_fd == -1) return;
+
+	if (_wd != -1) inotify_rm_watch(_fd, _wd);
+	_wd = inotify_add_watch(_fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO);
+
+	// Anything already read is about the old directory
+	reload_check();
+}
+
+void reload_stop(void) {
+	if (_fd != -1) {
+		close(_fd);
+		_fd = -1;
+	}
+
+	if (_pending) {
+		_free_tree(_pending, _npending);
+		_pending = NULL;
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include "common.h"
+
+// Reloading the splits file when it changes. The input thread watches for
+// changes and parses the new file without holding the state lock, then
+// swaps it in between frames. The pb and golds of splits which are still
+// there are kept, without reading the times files again
+
+// Start watching the directory. Returns an fd to poll, or -1
+int reload_watch(void);
+// Read the pending change notifications. Returns whether the splits file
+// has changed
+bool reload_check(void);
+// Parse the splits file and keep it to be swapped in. Doesn't touch the
+// state, so it's called without the lock
+void reload_parse(void);
+// Swap in the parsed splits if there is no run in progress, in which case
+// it's held until the next reset. Must be called with the state locked.
+// Returns whether the splits changed
+bool reload_apply(struct state *s);
+// Watch the working directory instead, after switching profile, and drop
+// any splits parsed from the old one
+void reload_switch(void);
+void reload_stop(void);
+
+#endif
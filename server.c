@@ -0,0 +1,477 @@
+#define _GNU_SOURCE
+
+#include "calc.h"
+#include "common.h"
+#include "profile.h"
+#include "timer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// adrift-server runs the timers of many runners at once, without a window,
+// for races. Each directory given is a session, loaded just like a profile,
+// with a socket in it for that runner's splitter to send rift data to.
+// Everyone's progress is combined into a standings feed on another socket
+
+#define INPUT_BUF_SIZE 4096
+#define MAX_EVENTS 64
+// However fast times come in, the standings are sent at most this often
+#define STANDINGS_INTERVAL_MS 100
+#define DEFAULT_SESSION_SOCKET "timer.sock"
+#define DEFAULT_STANDINGS_SOCKET "standings.sock"
+
+struct session {
+	struct profile prof;
+	struct state s;
+	const char *name;
+	const char *sock_path; // Relative to the session's directory
+};
+
+enum conn_kind {
+	CONN_SESSION_LISTENER,
+	CONN_RUNNER,
+	CONN_FEED_LISTENER,
+	CONN_FEED,
+};
+
+struct conn {
+	struct conn *next;
+
+	enum conn_kind kind;
+	int fd;
+	struct session *session; // Session listeners and runners only
+
+	// Lines from a runner which couldn't be parsed. Only the first is
+	// reported straight away
+	unsigned nbad;
+
+	size_t len;
+	char buf[INPUT_BUF_SIZE];
+};
+
+enum standing_status {
+	STANDING_FINISHED,
+	STANDING_RUNNING,
+	STANDING_IDLE,
+};
+
+struct standing {
+	struct session *se;
+	enum standing_status status;
+	size_t done; // Splits passed
+	uint64_t reached; // When the last split passed was reached, or the final time
+};
+
+static volatile sig_atomic_t _should_exit;
+
+static int _epfd;
+static struct conn *_conns;
+
+// Fires once the standings may be sent again after a change
+static int _flush_fd = -1;
+static bool _flush_armed;
+
+static void int_handler(int signal) {
+	_should_exit = 1;
+}
+
+static struct conn *_add_conn(enum conn_kind kind, int fd, struct session *se) {
+	struct conn *c = malloc(sizeof *c);
+	*c = (struct conn){
+		.next = _conns,
+		.kind = kind,
+		.fd = fd,
+		.session = se,
+	};
+	_conns = c;
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+	epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev);
+
+	return c;
+}
+
+static void _free_conn(struct conn *c) {
+	if (c->nbad > 1) {
+		fprintf(stderr, "Warning: %u more bad lines of input data for %s\n", c->nbad - 1, c->session->name);
+	}
+
+	for (struct conn **p = &_conns; *p; p = &(*p)->next) {
+		if (*p == c) {
+			*p = c->next;
+			break;
+		}
+	}
+
+	epoll_ctl(_epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c);
+}
+
+// Listen on a socket, relative to the working directory
+static bool _listen(enum conn_kind kind, const char *path, struct session *se) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "Socket path %s is too long\n", path);
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) return false;
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof addr) == -1 || listen(fd, 8) == -1) {
+		fprintf(stderr, "Failed to listen on %s\n", path);
+		close(fd);
+		return false;
+	}
+
+	_add_conn(kind, fd, se);
+	return true;
+}
+
+static struct standing _get_standing(struct session *se) {
+	struct state *s = &se->s;
+	struct split *final = get_final_split(s);
+
+	if (s->active_split != -1) {
+		return (struct standing){
+			.se = se,
+			.status = STANDING_RUNNING,
+			.done = s->active_split,
+			.reached = s->active_split > 0 ? get_prev_cur(s, s->active_split) : 0,
+		};
+	}
+
+	if (final->split.times.cur != UINT64_MAX) {
+		return (struct standing){
+			.se = se,
+			.status = STANDING_FINISHED,
+			.done = s->nids,
+			.reached = final->split.times.cur,
+		};
+	}
+
+	return (struct standing){ .se = se, .status = STANDING_IDLE };
+}
+
+// Finished runners first, fastest first, then whoever's furthest on, then
+// whoever got there first. Ties keep the order the sessions were given in
+static int _cmp_standing(const void *a, const void *b) {
+	const struct standing *x = a, *y = b;
+
+	if (x->status != y->status) return x->status < y->status ? -1 : 1;
+	if (x->done != y->done) return x->done > y->done ? -1 : 1;
+	if (x->reached != y->reached) return x->reached < y->reached ? -1 : 1;
+	return x->se < y->se ? -1 : x->se > y->se;
+}
+
+static void _put_time(FILE *f, uint64_t t) {
+	if (t == UINT64_MAX) {
+		fputs("\t-", f);
+	} else {
+		fprintf(f, "\t%"PRIu64, t);
+	}
+}
+
+// How far ahead of or behind their PB a runner was at the last split they
+// timed, compared to the same split of the PB
+static void _put_delta(FILE *f, struct standing *st) {
+	struct state *s = &st->se->s;
+	struct split *sp = NULL;
+
+	if (st->status == STANDING_FINISHED) {
+		sp = get_final_split(s);
+	} else if (st->status == STANDING_RUNNING) {
+		for (int id = s->active_split - 1; id >= 0 && !sp; --id) {
+			struct split *p = get_split_by_id(s, id);
+			if (p->split.times.cur != UINT64_MAX) sp = p;
+		}
+	}
+
+	if (!sp || sp->split.times.pb == UINT64_MAX) {
+		fputs("\t-", f);
+		return;
+	}
+
+	int64_t delta = (int64_t)(sp->split.times.cur - sp->split.times.pb);
+	fprintf(f, "\t%+"PRId64, delta);
+}
+
+// Format the standings as a line for each runner, in order, and a blank
+// line. Returns a buffer to be freed
+static char *_build_standings(struct session *sessions, size_t nsessions, size_t *len) {
+	struct standing *st = malloc(nsessions * sizeof st[0]);
+	for (size_t i = 0; i < nsessions; ++i) {
+		st[i] = _get_standing(&sessions[i]);
+	}
+	qsort(st, nsessions, sizeof st[0], _cmp_standing);
+
+	static const char *const status_names[] = {
+		[STANDING_FINISHED] = "FINISHED",
+		[STANDING_RUNNING] = "RUNNING",
+		[STANDING_IDLE] = "IDLE",
+	};
+
+	char *buf;
+	FILE *f = open_memstream(&buf, len);
+
+	for (size_t i = 0; i < nsessions; ++i) {
+		struct state *s = &st[i].se->s;
+
+		fprintf(f, "%zu\t%s\t%zu/%zu", i + 1, status_names[st[i].status], st[i].done, s->nids);
+		_put_time(f, st[i].status == STANDING_RUNNING ? s->timer : st[i].status == STANDING_FINISHED ? st[i].reached : UINT64_MAX);
+		_put_delta(f, &st[i]);
+		_put_time(f, calc_best_possible_time(s));
+		fprintf(f, "\t%s\n", st[i].se->name);
+	}
+	fputc('\n', f);
+
+	fclose(f);
+	free(st);
+
+	return buf;
+}
+
+/* Send the standings to a feed without blocking. A feed which isn't
+ * keeping up misses them, and gets the next; one which has got part of
+ * them can't be resynced, so it's dropped. Returns false if it was. */
+static bool _send_standings(struct conn *c, const char *buf, size_t len) {
+	ssize_t n = send(c->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (n == (ssize_t)len || (n == -1 && errno == EAGAIN)) return true;
+
+	_free_conn(c);
+	return false;
+}
+
+static void _flush(struct session *sessions, size_t nsessions) {
+	size_t len;
+	char *buf = _build_standings(sessions, nsessions, &len);
+
+	struct conn *next;
+	for (struct conn *c = _conns; c; c = next) {
+		next = c->next;
+		if (c->kind == CONN_FEED) _send_standings(c, buf, len);
+	}
+
+	free(buf);
+}
+
+static void _accept(struct conn *listener, struct session *sessions, size_t nsessions) {
+	enum conn_kind kind = listener->kind == CONN_FEED_LISTENER ? CONN_FEED : CONN_RUNNER;
+
+	int fd;
+	while ((fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+		struct conn *c = _add_conn(kind, fd, listener->session);
+
+		// New feeds get the standings straight away
+		if (kind == CONN_FEED) {
+			size_t len;
+			char *buf = _build_standings(sessions, nsessions, &len);
+			_send_standings(c, buf, len);
+			free(buf);
+		}
+	}
+}
+
+static void _handle_line(struct conn *c, char *line) {
+	struct state *s = &c->session->s;
+
+	if (timer_parse(s, line) != TIMER_PARSE_OK && c->nbad++ == 0) {
+		fprintf(stderr, "Warning: bad input data for %s! Got line '%s'\n", c->session->name, line);
+	}
+}
+
+/* Read whatever is available from a connection, handling each complete
+ * line from a runner; feeds have nothing to say. Returns false if the
+ * connection has reached EOF or failed. */
+static bool _read_conn(struct conn *c) {
+	ssize_t n;
+	do {
+		n = read(c->fd, c->buf + c->len, sizeof c->buf - c->len);
+	} while (n == -1 && errno == EINTR);
+
+	if (n == -1) return errno == EAGAIN;
+	if (n == 0) return false;
+
+	if (c->kind == CONN_FEED) return true;
+
+	c->len += n;
+
+	char *start = c->buf, *end = c->buf + c->len, *nl;
+	while ((nl = memchr(start, '\n', end - start))) {
+		*nl = 0;
+		_handle_line(c, start);
+		start = nl + 1;
+	}
+
+	c->len = end - start;
+	if (c->len == sizeof c->buf) {
+		// A line longer than the buffer; nobody sends those
+		fputs("Warning: overlong input line\n", stderr);
+		c->len = 0;
+	} else {
+		memmove(c->buf, start, c->len);
+	}
+
+	return true;
+}
+
+static void _arm_flush(void) {
+	struct itimerspec its = {
+		.it_value = {
+			.tv_sec = STANDINGS_INTERVAL_MS / 1000,
+			.tv_nsec = STANDINGS_INTERVAL_MS % 1000 * 1000000L,
+		},
+	};
+	timerfd_settime(_flush_fd, 0, &its, NULL);
+	_flush_armed = true;
+}
+
+int main(int argc, char **argv) {
+	const char *feed_path = DEFAULT_STANDINGS_SOCKET;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "hs:")) != -1) {
+		switch (opt) {
+		case 's':
+			feed_path = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s standings_socket] directory...\n", argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	if (optind == argc) {
+		fprintf(stderr, "Usage: %s [-s standings_socket] directory...\n", argv[0]);
+		return 1;
+	}
+
+	_epfd = epoll_create1(EPOLL_CLOEXEC);
+	_flush_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (_epfd == -1 || _flush_fd == -1) {
+		fputs("Failed to set up event loop\n", stderr);
+		return 1;
+	}
+
+	struct epoll_event flush_ev = { .events = EPOLLIN, .data.ptr = &_flush_fd };
+	epoll_ctl(_epfd, EPOLL_CTL_ADD, _flush_fd, &flush_ev);
+
+	size_t nsessions = argc - optind;
+	struct session *sessions = calloc(nsessions, sizeof sessions[0]);
+
+	// Each session's socket is made in its directory, so the paths are all
+	// relative to where the server started
+	int start_dir = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	for (size_t i = 0; i < nsessions; ++i) {
+		struct session *se = &sessions[i];
+
+		if (fchdir(start_dir) || !profile_open(&se->prof, argv[optind + i]) || !profile_load(&se->prof)) {
+			return 1;
+		}
+
+		se->s = (struct state){
+			.active_split = -1,
+			// Sessions have no journal, so finished runs are written to
+			// the profile's directory as they finish
+			.nprofiles = 1,
+			.profiles = &se->prof,
+			.cfg = se->prof.cfg,
+		};
+		profile_activate(&se->s, &se->prof);
+
+		se->name = config_get_str(se->prof.cfg, "runner", se->prof.path);
+		se->sock_path = config_get_str(se->prof.cfg, "server_socket", DEFAULT_SESSION_SOCKET);
+
+		if (fchdir(se->prof.dirfd) || !_listen(CONN_SESSION_LISTENER, se->sock_path, se)) {
+			return 1;
+		}
+	}
+
+	if (fchdir(start_dir) || !_listen(CONN_FEED_LISTENER, feed_path, NULL)) {
+		return 1;
+	}
+
+	signal(SIGINT, int_handler);
+	signal(SIGTERM, int_handler);
+
+	struct epoll_event events[MAX_EVENTS];
+
+	while (!_should_exit) {
+		int n = epoll_wait(_epfd, events, MAX_EVENTS, -1);
+
+		bool changed = false, flush = false;
+
+		for (int i = 0; i < n; ++i) {
+			if (events[i].data.ptr == &_flush_fd) {
+				uint64_t expirations;
+				read(_flush_fd, &expirations, sizeof expirations);
+				_flush_armed = false;
+				flush = true;
+				continue;
+			}
+
+			struct conn *c = events[i].data.ptr;
+
+			if (c->kind == CONN_SESSION_LISTENER || c->kind == CONN_FEED_LISTENER) {
+				_accept(c, sessions, nsessions);
+				continue;
+			}
+
+			struct view before = c->session ? get_view(&c->session->s) : (struct view){ 0 };
+
+			bool ok;
+			if (events[i].events & EPOLLIN) {
+				ok = _read_conn(c);
+			} else {
+				ok = !(events[i].events & (EPOLLHUP | EPOLLERR));
+			}
+
+			if (c->session) {
+				struct view after = get_view(&c->session->s);
+				if (!view_eq(&before, &after)) changed = true;
+			}
+
+			if (!ok) _free_conn(c);
+		}
+
+		// Sent after the events are handled, as a feed may be dropped
+		if (flush) _flush(sessions, nsessions);
+
+		if (changed && !_flush_armed) _arm_flush();
+	}
+
+	while (_conns) {
+		struct conn *c = _conns;
+		if (c->kind == CONN_FEED_LISTENER) {
+			unlinkat(start_dir, feed_path, 0);
+		} else if (c->kind == CONN_SESSION_LISTENER) {
+			unlinkat(c->session->prof.dirfd, c->session->sock_path, 0);
+		}
+		_free_conn(c);
+	}
+
+	close(start_dir);
+	close(_flush_fd);
+	close(_epfd);
+
+	for (size_t i = 0; i < nsessions; ++i) {
+		profile_deactivate(&sessions[i].s, &sessions[i].prof);
+		profile_free(&sessions[i].prof);
+	}
+	free(sessions);
+
+	return 0;
+}
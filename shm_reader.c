@@ -0,0 +1,132 @@
+#include "adrift_shm.h"
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// A reference reader of adrift's shared memory, which prints the state
+// whenever it changes. Polling needs no system calls; this only sleeps
+// between polls so as not to spin
+
+#define POLL_INTERVAL_MS 16
+
+static const struct adrift_shm *_shm;
+static size_t _len;
+static uint32_t _capacity; // Of the mapping
+
+static bool _map(int fd) {
+	struct stat st;
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof *_shm) return false;
+
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) return false;
+
+	if (_shm) munmap((void *)_shm, _len);
+	_shm = p;
+	_len = st.st_size;
+	_capacity = (_len - sizeof *_shm) / sizeof _shm->splits[0];
+
+	return true;
+}
+
+/* Copy a consistent snapshot of the state, and of the split table if
+ * splits isn't NULL, which must have room for _capacity splits. Returns
+ * false if the segment has grown and must be mapped again. */
+static bool _read(struct adrift_shm_state *state, struct adrift_shm_split *splits) {
+	while (true) {
+		uint32_t seq = atomic_load_explicit(&_shm->seq, memory_order_acquire);
+		if (seq & 1) continue;
+
+		*state = _shm->state;
+		bool fits = _shm->capacity <= _capacity && state->nsplits <= _capacity;
+		if (fits && splits) memcpy(splits, _shm->splits, state->nsplits * sizeof splits[0]);
+
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&_shm->seq, memory_order_relaxed) == seq) return fits;
+	}
+}
+
+static void _print_time(const char *label, uint64_t t) {
+	if (t == UINT64_MAX) {
+		printf(" %s=-", label);
+	} else {
+		printf(" %s=%"PRIu64, label, t);
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *name = argc > 1 ? argv[1] : "/adrift";
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1 || !_map(fd)) {
+		fprintf(stderr, "Failed to open shared memory %s\n", name);
+		return 1;
+	}
+
+	if (memcmp(_shm->magic, ADRIFT_SHM_MAGIC, sizeof _shm->magic) || _shm->version != ADRIFT_SHM_VERSION) {
+		fprintf(stderr, "%s isn't a version %d adrift state\n", name, ADRIFT_SHM_VERSION);
+		return 1;
+	}
+
+	struct adrift_shm_split *splits = NULL;
+	uint32_t seq = UINT32_MAX, layout_gen = 0;
+	bool have_layout = false;
+
+	struct timespec interval = { .tv_nsec = POLL_INTERVAL_MS * 1000000L };
+
+	while (true) {
+		uint32_t cur_seq = atomic_load_explicit(&_shm->seq, memory_order_acquire);
+		if (cur_seq == seq) {
+			nanosleep(&interval, NULL);
+			continue;
+		}
+
+		struct adrift_shm_state state;
+		if (!_read(&state, NULL)) {
+			if (!_map(fd)) return 1;
+			continue;
+		}
+
+		// The table is only copied when it has changed
+		if (!have_layout || state.layout_gen != layout_gen) {
+			splits = realloc(splits, _capacity * sizeof splits[0]);
+			if (!_read(&state, splits)) {
+				if (!_map(fd)) return 1;
+				continue;
+			}
+
+			printf("%s / %s:\n", state.game, state.category);
+			for (uint32_t i = 0; i < state.nsplits; ++i) {
+				printf("  %*s%s", (int)splits[i].depth * 2, "", splits[i].name);
+				_print_time("cur", splits[i].cur);
+				_print_time("pb", splits[i].pb);
+				_print_time("best", splits[i].best);
+				putchar('\n');
+			}
+
+			layout_gen = state.layout_gen;
+			have_layout = true;
+		}
+
+		printf("split=%"PRId32, state.active_split);
+		_print_time("timer", state.timer);
+		_print_time("split_time", state.split_time);
+		if (state.delta == INT64_MIN) {
+			fputs(" delta=-", stdout);
+		} else {
+			printf(" delta=%+"PRId64, state.delta);
+		}
+		_print_time("sob", state.sum_of_best);
+		_print_time("bpt", state.best_possible_time);
+		putchar('\n');
+		fflush(stdout);
+
+		seq = cur_seq;
+	}
+}
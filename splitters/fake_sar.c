@@ -0,0 +1,262 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A stand-in for Portal 2 with SAR loaded, for testing and profiling
+ * splitters without the game. It names itself portal2_linux, places a
+ * SAR timer structure at a random offset in a large heap, and plays back
+ * a script of timer actions in real time.
+ *
+ * Each line of the script is a tick number followed by an action (one
+ * of START, SPLIT, RESTART, RESET, END, PAUSE, RESUME), which is applied
+ * when that many ticks have passed since the script started. Blank lines
+ * and lines starting with '#' are ignored. As splitters only notice an
+ * action when it changes, each action reverts to NOTHING after half a
+ * second, so repeating an action needs a gap at least that long. The game
+ * exits one second after the last action.
+ *
+ * Whenever the action changes, a line of the form "<ns> <ACTION>" is
+ * written to stdout, where <ns> is CLOCK_MONOTONIC in nanoseconds. A line
+ * "<ns> READY" is written once the timer is in memory. */
+
+#define DEFAULT_HEAP_MB 64
+#define TICK_RATE 60
+#define ACTION_HOLD_TICKS (TICK_RATE / 2)
+
+enum timer_action {
+	NOTHING,
+	START,
+	RESTART,
+	SPLIT,
+	END,
+	RESET,
+	PAUSE,
+	RESUME,
+};
+
+static const char *const action_names[] = {
+	[NOTHING] = "NOTHING",
+	[START] = "START",
+	[RESTART] = "RESTART",
+	[SPLIT] = "SPLIT",
+	[END] = "END",
+	[RESET] = "RESET",
+	[PAUSE] = "PAUSE",
+	[RESUME] = "RESUME",
+};
+
+struct sar_timer {
+	char start[16];
+	int total;
+	float ipt;
+	int action;
+	char end[14];
+};
+
+struct step {
+	uint64_t tick;
+	enum timer_action action;
+};
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t t) {
+	struct timespec ts = {
+		.tv_sec = t / 1000000000,
+		.tv_nsec = t % 1000000000,
+	};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static size_t read_script(FILE *f, struct step **out) {
+	size_t alloc = 16, n = 0;
+	struct step *steps = malloc(alloc * sizeof steps[0]);
+
+	char *line = NULL;
+	size_t len = 0;
+	unsigned lineno = 0;
+	while (getline(&line, &len, f) > 0) {
+		++lineno;
+
+		uint64_t tick;
+		char act[16];
+		if (line[0] == '#' || line[0] == '\n') continue;
+		if (sscanf(line, "%"SCNu64" %15s", &tick, act) != 2) {
+			fprintf(stderr, "[WARN] Ignoring bad script line %u\n", lineno);
+			continue;
+		}
+
+		enum timer_action a = NOTHING;
+		for (size_t i = 0; i < sizeof action_names / sizeof action_names[0]; ++i) {
+			if (!strcmp(act, action_names[i])) a = i;
+		}
+
+		if (a == NOTHING) {
+			fprintf(stderr, "[WARN] Unknown action '%s' on script line %u\n", act, lineno);
+			continue;
+		}
+
+		if (n == alloc) {
+			alloc *= 2;
+			steps = realloc(steps, alloc * sizeof steps[0]);
+		}
+
+		steps[n++] = (struct step){ tick, a };
+	}
+
+	free(line);
+
+	*out = steps;
+	return n;
+}
+
+static int usage(char *argv0) {
+	fprintf(stderr, "Usage: %s [-m heap MiB] [script]\n", argv0);
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	// Splitters find the game by the basename of argv[0], so re-exec
+	// ourselves under the right name if needed
+	if (strcmp(basename(argv[0]), "portal2_linux")) {
+		argv[0] = "portal2_linux";
+		execv("/proc/self/exe", argv);
+		fputs("[ERR] Failed to re-exec as portal2_linux\n", stderr);
+		return 1;
+	}
+
+	// The re-exec leaves comm as "exe"
+	prctl(PR_SET_NAME, "portal2_linux");
+	// Let unrelated processes (the splitter) read our memory under Yama
+	prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY);
+
+	size_t heap_mb = DEFAULT_HEAP_MB;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "m:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			heap_mb = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (argc - optind > 1) {
+		return usage(argv[0]);
+	}
+
+	FILE *f = stdin;
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			fprintf(stderr, "[ERR] Failed to open script '%s'\n", argv[optind]);
+			return 1;
+		}
+	}
+
+	struct step *steps;
+	size_t nsteps = read_script(f, &steps);
+	if (f != stdin) fclose(f);
+
+	// Grow the real heap with sbrk, as splitters look for the timer in the
+	// mapping labelled [heap] and malloc would use mmap for this size
+	size_t heap_len = heap_mb << 20;
+	if (heap_len < sizeof (struct sar_timer)) heap_len = sizeof (struct sar_timer);
+	char *heap = sbrk(heap_len);
+	if (heap == (void *)-1) {
+		fputs("[ERR] Failed to grow heap\n", stderr);
+		return 1;
+	}
+
+	// Fill the heap with junk so scanning it is realistic
+	uint64_t x = now_ns() | 1;
+	for (size_t i = 0; i + 8 <= heap_len; i += 8) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		memcpy(heap + i, &x, 8);
+	}
+
+	size_t off = (x % (heap_len - sizeof (struct sar_timer) + 1)) & ~(size_t)3;
+	struct sar_timer *timer = (struct sar_timer *)(heap + off);
+	memcpy(timer->start, "SAR_TIMER_START", 16);
+	memcpy(timer->end, "SAR_TIMER_END", 14);
+	timer->total = 0;
+	timer->ipt = 1.0f / TICK_RATE;
+	timer->action = NOTHING;
+
+	volatile struct sar_timer *t = timer;
+
+	fprintf(stderr, "[LOG] Timer placed at heap offset %zx\n", off);
+	printf("%"PRIu64" READY\n", now_ns());
+	fflush(stdout);
+
+	uint64_t start = now_ns();
+	uint64_t tick_ns = 1000000000 / TICK_RATE;
+	bool running = false;
+
+	size_t next = 0;
+	uint64_t hold_until = 0;
+	uint64_t last_tick = nsteps ? steps[nsteps - 1].tick + TICK_RATE : 0;
+
+	for (uint64_t tick = 0; tick <= last_tick; ++tick) {
+		sleep_until_ns(start + tick * tick_ns);
+
+		if (running) t->total++;
+		if (tick == hold_until) t->action = NOTHING;
+
+		while (next < nsteps && steps[next].tick <= tick) {
+			enum timer_action a = steps[next++].action;
+
+			// Taken before the action is visible, as the splitter may see
+			// it before it's logged
+			uint64_t ns = now_ns();
+
+			switch (a) {
+			case START:
+			case RESTART:
+				t->total = 0;
+				running = true;
+				break;
+			case RESET:
+				t->total = 0;
+				running = false;
+				break;
+			case END:
+			case PAUSE:
+				running = false;
+				break;
+			case RESUME:
+				running = true;
+				break;
+			default:
+				break;
+			}
+
+			t->action = a;
+			hold_until = tick + ACTION_HOLD_TICKS;
+			printf("%"PRIu64" %s\n", ns, action_names[a]);
+			fflush(stdout);
+		}
+	}
+
+	free(steps);
+
+	return 0;
+}
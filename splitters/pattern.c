@@ -0,0 +1,185 @@
+#include "splitter.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Mappings are read in chunks small enough to stay in cache while every
+// pattern is matched against them, so each byte of the game's memory is
+// only brought in from RAM once however many patterns there are
+#define SIGSCAN_CHUNK (256 << 10)
+
+// Rough relative frequencies of bytes in x86-64 code and data. Anything
+// not listed is assumed to be uncommon. Used to pick the anchor byte of a
+// pattern, as a rarer anchor means fewer candidate positions to verify.
+static const uint8_t _byte_freq[256] = {
+	[0x00] = 255, [0xFF] = 160, [0xCC] = 100, [0x48] = 120, [0x8B] = 90,
+	[0x89] = 80, [0x0F] = 60, [0x01] = 60, [0x44] = 50, [0x24] = 50,
+	[0xE8] = 50, [0x4C] = 40, [0x45] = 40, [0x85] = 35, [0x74] = 35,
+	[0x83] = 35, [0x8D] = 35, [0xC0] = 30, [0x90] = 30, [0xC3] = 25,
+	[0x10] = 25, [0x08] = 25, [0x20] = 25, [0x02] = 20, [0x04] = 20,
+	[0x75] = 20, [0xE9] = 20, [0x41] = 20, [0x49] = 20, [0x80] = 20,
+	[0x31] = 15, [0x30] = 15, [0x18] = 15, [0x28] = 15, [0x40] = 15,
+};
+
+int sp_pattern_compile(struct sp_pattern *p, const char *str) {
+	size_t cap = strlen(str) / 2 + 1;
+	p->bytes = malloc(cap);
+	p->mask = malloc(cap);
+	p->len = 0;
+	p->addr = NULL;
+
+	if (!p->bytes || !p->mask) goto err;
+
+	bool have_fixed = false;
+
+	while (true) {
+		while (isspace((unsigned char)*str)) ++str;
+		if (!*str) break;
+
+		if (str[0] == '?') {
+			str += str[1] == '?' ? 2 : 1;
+			p->bytes[p->len] = 0;
+			p->mask[p->len] = 0x00;
+		} else {
+			if (!isxdigit((unsigned char)str[0]) || !isxdigit((unsigned char)str[1])) goto err;
+			char hex[3] = { str[0], str[1], 0 };
+			str += 2;
+			uint8_t b = strtoul(hex, NULL, 16);
+
+			if (!have_fixed || _byte_freq[b] < _byte_freq[p->bytes[p->anchor]]) {
+				p->anchor = p->len;
+			}
+			have_fixed = true;
+
+			p->bytes[p->len] = b;
+			p->mask[p->len] = 0xFF;
+		}
+
+		if (*str && !isspace((unsigned char)*str)) goto err;
+
+		++p->len;
+	}
+
+	// A pattern of only wildcards would match everywhere, and has nothing
+	// to anchor on
+	if (!have_fixed) goto err;
+
+	return 0;
+
+err:
+	sp_pattern_free(p);
+	return 1;
+}
+
+void sp_pattern_free(struct sp_pattern *p) {
+	free(p->bytes);
+	free(p->mask);
+	p->bytes = p->mask = NULL;
+	p->len = 0;
+}
+
+static bool _pattern_matches(const struct sp_pattern *p, const uint8_t *at) {
+	size_t i = 0;
+
+	// Compare a word at a time; the compiler turns the memcpys into
+	// unaligned loads
+	for (; i + 8 <= p->len; i += 8) {
+		uint64_t v, m, b;
+		memcpy(&v, at + i, 8);
+		memcpy(&m, p->mask + i, 8);
+		memcpy(&b, p->bytes + i, 8);
+		if ((v & m) != b) return false;
+	}
+
+	for (; i < p->len; ++i) {
+		if ((at[i] & p->mask[i]) != p->bytes[i]) return false;
+	}
+
+	return true;
+}
+
+/* Find the first match of p in buf, returning its offset or -1. */
+static ssize_t _pattern_find(const struct sp_pattern *p, const uint8_t *buf, size_t len) {
+	if (len < p->len) return -1;
+
+	// Candidate anchors lie in [anchor, len - p->len + anchor]; memchr is
+	// vectorized by libc so skipping to them is cheap
+	const uint8_t *start = buf + p->anchor;
+	const uint8_t *end = start + (len - p->len) + 1;
+	uint8_t anchor = p->bytes[p->anchor];
+
+	for (const uint8_t *a = start; a < end; ++a) {
+		a = memchr(a, anchor, end - a);
+		if (!a) break;
+		if (_pattern_matches(p, a - p->anchor)) {
+			return a - p->anchor - buf;
+		}
+	}
+
+	return -1;
+}
+
+size_t sp_sigscan(struct sp_ctx *ctx, struct sp_pattern *pats, size_t npats) {
+	size_t max_len = 0;
+	for (size_t i = 0; i < npats; ++i) {
+		pats[i].addr = NULL;
+		if (pats[i].len > max_len) max_len = pats[i].len;
+	}
+
+	if (!npats) return 0;
+
+	// Consecutive chunks overlap by max_len - 1 bytes so that matches
+	// crossing a chunk boundary are still found
+	size_t bufsz = SIGSCAN_CHUNK + max_len - 1;
+	uint8_t *buf = malloc(bufsz);
+	if (!buf) {
+		fprintf(stderr, "[WARN] Failed to allocate scan buffer of size %zx\n", bufsz);
+		return 0;
+	}
+
+	struct sp_range *ranges = sp_get_ranges(ctx->pid, false);
+	size_t nfound = 0;
+
+	for (struct sp_range *r = ranges; r && nfound < npats; r = r->next) {
+		if (!r->readable) continue;
+
+		size_t off = 0;
+		while (nfound < npats && off < r->len) {
+			size_t len = r->len - off;
+			if (len > bufsz) len = bufsz;
+
+			if (sp_read(ctx, (char *)r->start + off, buf, len)) {
+				// Some readable mappings (e.g. device memory) can't be read
+				// remotely; that's not worth a warning
+				break;
+			}
+
+			for (size_t i = 0; i < npats; ++i) {
+				if (pats[i].addr) continue;
+				ssize_t at = _pattern_find(&pats[i], buf, len);
+				if (at != -1) {
+					pats[i].addr = (char *)r->start + off + at;
+					++nfound;
+				}
+			}
+
+			if (off + len == r->len) break;
+			off += len - (max_len - 1);
+		}
+	}
+
+	sp_free_ranges(ranges);
+	free(buf);
+
+	return nfound;
+}
+
+void *sp_resolve_rel32(struct sp_ctx *ctx, void *addr, size_t rel_off, size_t instr_len) {
+	int32_t rel;
+	if (sp_read(ctx, (char *)addr + rel_off, &rel, sizeof rel)) {
+		return NULL;
+	}
+	return (char *)addr + instr_len + rel;
+}
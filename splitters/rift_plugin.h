@@ -0,0 +1,52 @@
+#ifndef RIFT_PLUGIN_H
+#define RIFT_PLUGIN_H
+
+#include <stdint.h>
+
+/* The ABI for splitters loaded into adrift as shared objects, as an
+ * alternative to running them as a separate process which writes rift
+ * data to a pipe. A plugin exports a function named by
+ * RIFT_PLUGIN_ENTRY which returns its description. The host calls init
+ * once, then update repeatedly on a dedicated thread, then shutdown.
+ * Events are passed to the host in binary through rift_host.emit, with
+ * the same meaning as the corresponding lines of the text protocol. */
+
+#define RIFT_PLUGIN_ABI_VERSION 2
+#define RIFT_PLUGIN_ENTRY "rift_plugin_entry"
+
+enum rift_event {
+	RIFT_EV_TIME,
+	RIFT_EV_BEGIN,
+	RIFT_EV_SPLIT,
+	RIFT_EV_RESET,
+	// Hosts which predate these ignore them
+	RIFT_EV_PAUSE,
+	RIFT_EV_RESUME,
+};
+
+struct rift_host {
+	void *ctx;
+	void (*emit)(void *ctx, enum rift_event ev, uint64_t usec);
+};
+
+struct rift_plugin {
+	unsigned abi_version;
+
+	// Returns the plugin instance, or NULL on failure. host remains valid
+	// until shutdown is called
+	void *(*init)(const struct rift_host *host);
+	// Returns the number of milliseconds until update should next be
+	// called, or a negative value if the plugin has failed and should be
+	// shut down
+	int (*update)(void *inst);
+	void (*shutdown)(void *inst);
+
+	// Since version 2, and may be NULL. Called on the update thread
+	// whenever a run starts (active is nonzero) or ends, and once before
+	// the first update, so the plugin can poll less often between runs
+	void (*set_active)(void *inst, int active);
+};
+
+typedef const struct rift_plugin *(*rift_plugin_entry_fn)(void);
+
+#endif
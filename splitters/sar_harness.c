@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Runs a splitter against fake_sar playing back a script, and reports
+ * how long the splitter took to attach, the latency from each action
+ * changing in the game's memory to the corresponding rift line arriving,
+ * and the CPU time the splitter used, scaled to an hour. Exits 1 if an
+ * action was missed or the splitter sent an event no action called for. */
+
+#define MAX_PENDING 256
+
+struct pending {
+	uint64_t ns;
+	const char *event;
+};
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The rift events a splitter should emit in response to each SAR action,
+ * in order. */
+static const struct {
+	const char *action;
+	const char *events[3];
+} expected[] = {
+	{ "START", { "BEGIN" } },
+	{ "SPLIT", { "SPLIT" } },
+	{ "END", { "SPLIT" } },
+	{ "RESET", { "RESET" } },
+	{ "RESTART", { "RESET", "BEGIN" } },
+	{ "PAUSE", { "PAUSE" } },
+	{ "RESUME", { "RESUME" } },
+};
+
+/* The NULL-terminated events for an action, or NULL if it shouldn't emit
+ * any. */
+static const char *const *expected_events(const char *action) {
+	for (size_t i = 0; i < sizeof expected / sizeof expected[0]; ++i) {
+		if (!strcmp(expected[i].action, action)) return expected[i].events;
+	}
+	return NULL;
+}
+
+/* Lines read from a pipe. stdio isn't used, as lines it has buffered
+ * wouldn't wake poll. */
+struct lines {
+	int fd;
+	size_t start, len;
+	char buf[4096];
+};
+
+/* Read whatever is available into the buffer. Returns false at EOF or on
+ * error. */
+static bool lines_fill(struct lines *l) {
+	memmove(l->buf, l->buf + l->start, l->len - l->start);
+	l->len -= l->start;
+	l->start = 0;
+
+	// A line longer than the buffer; nothing sends those
+	if (l->len == sizeof l->buf) l->len = 0;
+
+	ssize_t n;
+	do {
+		n = read(l->fd, l->buf + l->len, sizeof l->buf - l->len);
+	} while (n == -1 && errno == EINTR);
+
+	if (n <= 0) return false;
+	l->len += n;
+	return true;
+}
+
+/* The next complete line in the buffer without its newline, or NULL if
+ * there isn't one. */
+static char *lines_next(struct lines *l) {
+	char *line = l->buf + l->start;
+	char *nl = memchr(line, '\n', l->len - l->start);
+	if (!nl) return NULL;
+
+	*nl = 0;
+	l->start = nl + 1 - l->buf;
+	return line;
+}
+
+static pid_t spawn(const char *path, char *const argv[], int *out, bool quiet) {
+	int pipefd[2];
+	if (pipe(pipefd) == -1) return -1;
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(pipefd[0]);
+		dup2(pipefd[1], STDOUT_FILENO);
+		if (quiet) {
+			int null = open("/dev/null", O_WRONLY);
+			dup2(null, STDERR_FILENO);
+		}
+		execv(path, argv);
+		fprintf(stderr, "[ERR] Failed to exec %s\n", path);
+		_exit(1);
+	}
+
+	close(pipefd[1]);
+	*out = pipefd[0];
+	return pid;
+}
+
+/* Read CPU time used by a process so far, in seconds. */
+static double cpu_seconds(pid_t pid) {
+	char pathbuf[32];
+	snprintf(pathbuf, sizeof pathbuf, "/proc/%d/stat", pid);
+
+	FILE *f = fopen(pathbuf, "r");
+	if (!f) return -1;
+
+	unsigned long utime, stime;
+	int ret = fscanf(f, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+	fclose(f);
+
+	if (ret != 2) return -1;
+	return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static int usage(char *argv0) {
+	fprintf(stderr, "Usage: %s [-g game] [-s splitter] [-m heap MiB] [-v] script\n", argv0);
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	char *game = "splitters/fake_sar";
+	char *splitter = "splitters/sar_split";
+	char *heap_mb = "64";
+	bool verbose = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "g:s:m:vh")) != -1) {
+		switch (opt) {
+		case 'g': game = optarg; break;
+		case 's': splitter = optarg; break;
+		case 'm': heap_mb = optarg; break;
+		case 'v': verbose = true; break;
+		default: return usage(argv[0]);
+		}
+	}
+
+	if (argc - optind != 1) {
+		return usage(argv[0]);
+	}
+
+	int game_fd;
+
+	pid_t game_pid = spawn(game, (char *[]){ game, "-m", heap_mb, argv[optind], NULL }, &game_fd, !verbose);
+	if (game_pid == -1) {
+		fputs("[ERR] Failed to start game\n", stderr);
+		return 1;
+	}
+
+	struct lines game_l = { .fd = game_fd }, split_l = { .fd = -1 };
+	char *line;
+
+	// Wait until the timer is in the game's memory before starting the
+	// splitter, so attach time doesn't include filling the heap
+	bool ready = false;
+	while (!ready && lines_fill(&game_l)) {
+		while (!ready && (line = lines_next(&game_l))) ready = strstr(line, " READY");
+	}
+
+	uint64_t spawned = now_ns();
+	pid_t split_pid = spawn(splitter, (char *[]){ splitter, NULL }, &split_l.fd, !verbose);
+	if (split_pid == -1) {
+		fputs("[ERR] Failed to start splitter\n", stderr);
+		kill(game_pid, SIGKILL);
+		return 1;
+	}
+
+	// Actions waiting for the splitter's event, and the splitter's events
+	// which arrived before the game logged their action, both by time
+	struct pending pending[MAX_PENDING], early[MAX_PENDING];
+	size_t npending = 0, nearly = 0;
+
+	uint64_t attached = 0;
+	bool handshake = false;
+	unsigned nlines = 0, nevents = 0, nunexpected = 0;
+	uint64_t lat_min = UINT64_MAX, lat_max = 0, lat_total = 0;
+
+	struct pollfd fds[] = {
+		{ .fd = game_fd, .events = POLLIN },
+		{ .fd = split_l.fd, .events = POLLIN },
+	};
+
+	uint64_t game_exited = 0;
+	bool split_exited = false;
+
+	while (!game_exited && !split_exited) {
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+			uint64_t t = now_ns();
+			if (!lines_fill(&split_l)) {
+				fputs("[ERR] Splitter exited\n", stderr);
+				split_exited = true;
+			}
+
+			while ((line = lines_next(&split_l))) {
+				++nlines;
+				if (!attached) attached = t;
+
+				char *ev = strchr(line, ' ');
+				if (!ev) continue;
+				++ev;
+
+				// The reset a splitter sends when it attaches, to the
+				// game's current time, isn't for any action
+				if (!handshake) {
+					handshake = true;
+					if (!strcmp(ev, "RESET")) continue;
+				}
+
+				++nevents;
+
+				size_t i;
+				for (i = 0; i < npending; ++i) {
+					if (!strcmp(pending[i].event, ev)) break;
+				}
+
+				if (i < npending) {
+					uint64_t lat = t - pending[i].ns;
+					if (lat < lat_min) lat_min = lat;
+					if (lat > lat_max) lat_max = lat;
+					lat_total += lat;
+					memmove(&pending[i], &pending[i + 1], (npending - i - 1) * sizeof pending[0]);
+					--npending;
+				} else if (nearly < MAX_PENDING) {
+					// Its action may not have been logged yet
+					early[nearly++] = (struct pending){ t, strdup(ev) };
+				} else {
+					++nunexpected;
+				}
+			}
+		}
+
+		if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+			if (!lines_fill(&game_l)) game_exited = now_ns();
+
+			while ((line = lines_next(&game_l))) {
+				uint64_t ns;
+				char action[16];
+				if (sscanf(line, "%"SCNu64" %15s", &ns, action) != 2) continue;
+
+				// Events from before this action can't be for it or any
+				// later one
+				size_t i = 0;
+				while (i < nearly && early[i].ns < ns) {
+					free((char *)early[i].event);
+					++nunexpected;
+					++i;
+				}
+				memmove(early, early + i, (nearly - i) * sizeof early[0]);
+				nearly -= i;
+
+				const char *const *evs = expected_events(action);
+				if (!evs) continue;
+
+				for (; *evs; ++evs) {
+					for (i = 0; i < nearly; ++i) {
+						if (!strcmp(early[i].event, *evs)) break;
+					}
+
+					if (i < nearly) {
+						uint64_t lat = early[i].ns - ns;
+						if (lat < lat_min) lat_min = lat;
+						if (lat > lat_max) lat_max = lat;
+						lat_total += lat;
+						free((char *)early[i].event);
+						memmove(&early[i], &early[i + 1], (nearly - i - 1) * sizeof early[0]);
+						--nearly;
+					} else if (npending < MAX_PENDING) {
+						pending[npending++] = (struct pending){ ns, *evs };
+					}
+				}
+			}
+		}
+	}
+
+	for (size_t i = 0; i < nearly; ++i) free((char *)early[i].event);
+	nunexpected += nearly;
+
+	double cpu = cpu_seconds(split_pid);
+	double wall = ((game_exited ? game_exited : now_ns()) - spawned) / 1e9;
+
+	kill(split_pid, SIGINT);
+	waitpid(split_pid, NULL, 0);
+	kill(game_pid, SIGKILL);
+	waitpid(game_pid, NULL, 0);
+
+	close(split_l.fd);
+	close(game_fd);
+
+	unsigned nmatched = nevents - nunexpected;
+
+	if (attached) {
+		printf("attach time:     %.3f ms\n", (attached - spawned) / 1e6);
+	} else {
+		puts("attach time:     never attached");
+	}
+	printf("lines received:  %u (%u events, %u not matched to an action)\n", nlines, nevents, nunexpected);
+	printf("missed actions:  %zu\n", npending);
+	if (nmatched) {
+		printf("action latency:  min %.3f ms, avg %.3f ms, max %.3f ms\n", lat_min / 1e6, lat_total / 1e6 / nmatched, lat_max / 1e6);
+	}
+	if (cpu >= 0 && wall > 0) {
+		printf("splitter CPU:    %.3f s over %.1f s (%.1f s/hour)\n", cpu, wall, cpu / wall * 3600);
+	}
+
+	return npending != 0 || nunexpected != 0;
+}
@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+
+#include "splitter.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Benchmarks sp_sigscan against a synthetic memory image. A child
+ * process maps an image of junk and plants a copy of each pattern near
+ * its end, so that almost all of it has to be scanned, then the parent
+ * scans the child for all the patterns at once and for the first alone.
+ * Exits 1 if any pattern isn't found where it was planted. */
+
+#define DEFAULT_IMAGE_MB 1024
+#define DEFAULT_NPATS 16
+#define PAT_LEN 12
+#define MAX_PATS 64
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Byte j of pattern i. These are computed whenever they're needed rather
+ * than kept anywhere, so the only copies in the child are the planted
+ * ones. */
+static uint8_t pat_byte(unsigned i, unsigned j) {
+	uint64_t x = (uint64_t)(i + 1) * 0x9E3779B97F4A7C15ull ^ (uint64_t)(j + 1) * 0xC2B2AE3D27D4EB4Full;
+	x ^= x >> 29;
+	x *= 0xBF58476D1CE4E5B9ull;
+	x ^= x >> 32;
+	return x;
+}
+
+/* Like "48 8B ?? ?? 89": bytes 2 and 3 are wildcards. */
+static bool pat_wild(unsigned j) {
+	return j == 2 || j == 3;
+}
+
+static size_t plant_offset(size_t image_len, unsigned i) {
+	return image_len - (size_t)(i + 1) * 4099;
+}
+
+/* Fill the image, plant the patterns, tell the parent where it is and
+ * wait for it to finish. */
+static int child_main(size_t image_len, unsigned npats, int out_fd, int in_fd) {
+	// Let the parent read our memory even under a strict Yama policy
+	prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY);
+
+	uint8_t *image = mmap(NULL, image_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (image == MAP_FAILED) return 1;
+
+	uint64_t x = 88172645463325252ull;
+	for (size_t i = 0; i + 8 <= image_len; i += 8) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		memcpy(image + i, &x, 8);
+	}
+
+	for (unsigned i = 0; i < npats; ++i) {
+		uint8_t *at = image + plant_offset(image_len, i);
+		for (unsigned j = 0; j < PAT_LEN; ++j) {
+			if (!pat_wild(j)) at[j] = pat_byte(i, j);
+		}
+	}
+
+	if (write(out_fd, &image, sizeof image) != sizeof image) return 1;
+
+	char c;
+	while (read(in_fd, &c, 1) == -1 && errno == EINTR);
+	return 0;
+}
+
+/* Scan for npats patterns, returning the seconds taken, or -1 if any
+ * wasn't found where it was planted. */
+static double scan(struct sp_ctx *ctx, struct sp_pattern *pats, unsigned npats, uint8_t *image, size_t image_len) {
+	uint64_t start = now_ns();
+	size_t nfound = sp_sigscan(ctx, pats, npats);
+	double secs = (now_ns() - start) / 1e9;
+
+	bool ok = nfound == npats;
+	for (unsigned i = 0; i < npats; ++i) {
+		if (pats[i].addr != image + plant_offset(image_len, i)) {
+			fprintf(stderr, "[ERR] Pattern %u found at %p, planted at %p\n", i, pats[i].addr, (void *)(image + plant_offset(image_len, i)));
+			ok = false;
+		}
+	}
+
+	return ok ? secs : -1;
+}
+
+static int usage(char *argv0) {
+	fprintf(stderr, "Usage: %s [-m image MiB] [-n patterns]\n", argv0);
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	size_t image_mb = DEFAULT_IMAGE_MB;
+	unsigned npats = DEFAULT_NPATS;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "m:n:h")) != -1) {
+		switch (opt) {
+		case 'm': image_mb = strtoul(optarg, NULL, 10); break;
+		case 'n': npats = strtoul(optarg, NULL, 10); break;
+		default: return usage(argv[0]);
+		}
+	}
+
+	if (optind != argc || npats < 1 || npats > MAX_PATS || image_mb < 1) {
+		return usage(argv[0]);
+	}
+
+	size_t image_len = image_mb << 20;
+
+	int to_parent[2], to_child[2];
+	if (pipe(to_parent) == -1 || pipe(to_child) == -1) {
+		fputs("[ERR] Failed to create pipes\n", stderr);
+		return 1;
+	}
+
+	pid_t pid = fork();
+	if (pid == -1) {
+		fputs("[ERR] Failed to fork\n", stderr);
+		return 1;
+	} else if (pid == 0) {
+		close(to_parent[0]);
+		close(to_child[1]);
+		_exit(child_main(image_len, npats, to_parent[1], to_child[0]));
+	}
+
+	close(to_parent[1]);
+	close(to_child[0]);
+
+	uint8_t *image;
+	if (read(to_parent[0], &image, sizeof image) != sizeof image) {
+		fputs("[ERR] Child failed to build the image\n", stderr);
+		waitpid(pid, NULL, 0);
+		return 1;
+	}
+
+	struct sp_pattern pats[MAX_PATS];
+	for (unsigned i = 0; i < npats; ++i) {
+		char str[PAT_LEN * 3 + 1], *p = str;
+		for (unsigned j = 0; j < PAT_LEN; ++j) {
+			if (pat_wild(j)) {
+				p += sprintf(p, "?? ");
+			} else {
+				p += sprintf(p, "%02X ", pat_byte(i, j));
+			}
+		}
+
+		if (sp_pattern_compile(&pats[i], str)) {
+			fprintf(stderr, "[ERR] Failed to compile pattern '%s'\n", str);
+			return 1;
+		}
+	}
+
+	struct sp_ctx ctx = { .pid = pid, .pidfd = -1 };
+
+	double all = scan(&ctx, pats, npats, image, image_len);
+	double one = scan(&ctx, pats, 1, image, image_len);
+
+	for (unsigned i = 0; i < npats; ++i) sp_pattern_free(&pats[i]);
+
+	close(to_child[1]);
+	waitpid(pid, NULL, 0);
+
+	if (all < 0 || one < 0) return 1;
+
+	printf("image:           %zu MiB\n", image_mb);
+	printf("%2u patterns:     %.3f s (%.0f MiB/s)\n", npats, all, image_mb / all);
+	printf(" 1 pattern:      %.3f s (%.0f MiB/s)\n", one, image_mb / one);
+
+	return 0;
+}
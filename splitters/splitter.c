@@ -0,0 +1,540 @@
+#define _GNU_SOURCE
+
+#include "splitter.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BACKOFF_MIN_MS 250
+#define BACKOFF_MAX_MS 8000
+
+// Memory is scanned in chunks of this size so that huge mappings don't
+// need an equally huge buffer
+#define SCAN_CHUNK (16 << 20)
+
+// Maximum number of iovecs the kernel accepts in one process_vm_readv
+#define SP_IOV_MAX 1024
+
+/* Check whether /proc/<pid>/comm names the given executable. comm is
+ * capped at 15 characters by the kernel and is a single short read, so
+ * this is a cheap filter to apply before reading the full cmdline. */
+static bool _comm_matches(pid_t pid, const char *name) {
+	char pathbuf[32]; // sufficient for pid INT_MAX
+	snprintf(pathbuf, sizeof pathbuf, "/proc/%d/comm", pid);
+
+	int cfd = open(pathbuf, O_RDONLY | O_CLOEXEC);
+	if (cfd == -1) return false;
+
+	char comm[17];
+	ssize_t n = read(cfd, comm, sizeof comm - 1);
+	close(cfd);
+
+	if (n <= 0) return false;
+	if (comm[n - 1] == '\n') --n;
+	comm[n] = 0;
+
+	return !strncmp(comm, name, 15);
+}
+
+pid_t sp_find_process(const char *name) {
+	DIR *d = opendir("/proc");
+	if (!d) return -1;
+
+	fputs("[LOG] Enumerating processes...\n", stderr);
+
+	struct dirent *de;
+	while ((de = readdir(d))) {
+		if (de->d_name[0] < '1' || de->d_name[0] > '9') continue;
+
+		pid_t pid = atoi(de->d_name);
+		if (pid > 0 && _comm_matches(pid, name)) {
+			char pathbuf[32]; // sufficient for pid INT_MAX
+			snprintf(pathbuf, sizeof pathbuf, "/proc/%d/cmdline", pid);
+
+			FILE *f = fopen(pathbuf, "r");
+			if (!f) continue;
+
+			char *cmdline = NULL;
+			size_t cmdlen = 0;
+			if (getline(&cmdline, &cmdlen, f) > 0) {
+				char *base = basename(cmdline);
+				if (!strcmp(base, name)) {
+					fprintf(stderr, "[LOG] Found %s process!\n", name);
+					free(cmdline);
+					fclose(f);
+					closedir(d);
+					return pid;
+				}
+			}
+
+			free(cmdline);
+			fclose(f);
+		}
+	}
+
+	closedir(d);
+	return -1;
+}
+
+struct sp_range *sp_get_ranges(pid_t pid, bool heap_only) {
+	if (pid <= 0) return NULL;
+
+	char pathbuf[32]; // sufficient for pid INT_MAX
+	snprintf(pathbuf, sizeof pathbuf, "/proc/%d/maps", pid);
+
+	FILE *f = fopen(pathbuf, "r");
+	if (!f) return NULL;
+
+	// Appended to, so the ranges are in the order of their addresses
+	struct sp_range *lst = NULL, **tail = &lst;
+
+	char *line = NULL;
+	size_t len = 0;
+	while (getline(&line, &len, f) > 0) {
+		uint64_t start, end;
+		char perms[8];
+		int name_start;
+		if (sscanf(line, "%lx-%lx %7s %*x %*u:%*u %*u %n", &start, &end, perms, &name_start) != 3) continue;
+
+		if (heap_only) {
+			if (strcmp("[heap]\n", line + name_start)) continue;
+		}
+
+		struct sp_range *tmp = malloc(sizeof *tmp);
+		tmp->next = NULL;
+		tmp->start = (void *)start;
+		tmp->len = end - start;
+		tmp->readable = perms[0] == 'r';
+		*tail = tmp;
+		tail = &tmp->next;
+	}
+
+	free(line);
+	fclose(f);
+
+	return lst;
+}
+
+void sp_free_ranges(struct sp_range *r) {
+	while (r) {
+		struct sp_range *next = r->next;
+		free(r);
+		r = next;
+	}
+}
+
+void *sp_scan(struct sp_ctx *ctx, bool heap_only, const void *needle, size_t needle_len, size_t match_len, bool (*check)(const char *match, void *u), void *u) {
+	struct sp_range *ranges = sp_get_ranges(ctx->pid, heap_only);
+
+	// Consecutive chunks overlap by match_len - 1 bytes so that matches
+	// crossing a chunk boundary are still found
+	size_t bufsz = SCAN_CHUNK + match_len - 1;
+	char *buf = malloc(bufsz);
+	if (!buf) {
+		fprintf(stderr, "[WARN] Failed to allocate scan buffer of size %zx\n", bufsz);
+		sp_free_ranges(ranges);
+		return NULL;
+	}
+
+	void *found = NULL;
+
+	for (struct sp_range *r = ranges; r && !found; r = r->next) {
+		fprintf(stderr, "[LOG] --- Scan range %lx-%lx ---\n", (uintptr_t)r->start, (uintptr_t)r->start + r->len);
+
+		size_t off = 0;
+		while (!found && off + match_len <= r->len) {
+			size_t len = r->len - off;
+			if (len > bufsz) len = bufsz;
+
+			if (sp_read(ctx, (char *)r->start + off, buf, len)) {
+				fprintf(stderr, "[WARN] Failed to read address range with errno %d. Skipping\n", errno);
+				break;
+			}
+
+			char *p = buf;
+			while ((p = memmem(p, buf + len - p, needle, needle_len))) {
+				if (p + match_len > buf + len) break; // Picked up by the next chunk
+				if (!check || check(p, u)) {
+					found = (char *)r->start + off + (p - buf);
+					break;
+				}
+				++p;
+			}
+
+			off += len - (match_len - 1);
+		}
+	}
+
+	free(buf);
+	sp_free_ranges(ranges);
+
+	return found;
+}
+
+int sp_read(struct sp_ctx *ctx, const void *addr, void *buf, size_t len) {
+	struct iovec local = {buf, len}, remote = {(void *)addr, len};
+	ssize_t len_read = syscall(SYS_process_vm_readv, ctx->pid, &local, 1, &remote, 1, 0);
+	return len_read != (ssize_t)len;
+}
+
+int sp_read_many(struct sp_ctx *ctx, const struct sp_read *reads, size_t n) {
+	struct iovec local[SP_IOV_MAX], remote[SP_IOV_MAX];
+
+	while (n) {
+		size_t batch = n > SP_IOV_MAX ? SP_IOV_MAX : n;
+		ssize_t total = 0;
+
+		for (size_t i = 0; i < batch; ++i) {
+			local[i] = (struct iovec){ reads[i].buf, reads[i].len };
+			remote[i] = (struct iovec){ (void *)reads[i].addr, reads[i].len };
+			total += reads[i].len;
+		}
+
+		ssize_t len_read = syscall(SYS_process_vm_readv, ctx->pid, local, batch, remote, batch, 0);
+		if (len_read != total) {
+			return 1;
+		}
+
+		reads += batch;
+		n -= batch;
+	}
+
+	return 0;
+}
+
+static const char *const _event_names[] = {
+	[SP_EV_TIME] = "",
+	[SP_EV_BEGIN] = " BEGIN",
+	[SP_EV_SPLIT] = " SPLIT",
+	[SP_EV_RESET] = " RESET",
+	[SP_EV_PAUSE] = " PAUSE",
+	[SP_EV_RESUME] = " RESUME",
+};
+
+void sp_emit(struct sp_ctx *ctx, enum sp_event ev, uint64_t usec) {
+	if (ctx->host) {
+		ctx->host->emit(ctx->host->ctx, (enum rift_event)ev, usec);
+		return;
+	}
+
+	char line[64];
+	int len = snprintf(line, sizeof line, "%"PRIu64"%s\n", usec, _event_names[ev]);
+
+	if (ctx->out_len + len > sizeof ctx->out_buf) {
+		sp_flush(ctx);
+	}
+
+	memcpy(ctx->out_buf + ctx->out_len, line, len);
+	ctx->out_len += len;
+}
+
+int sp_flush(struct sp_ctx *ctx) {
+	if (ctx->host) return 0;
+
+	size_t off = 0;
+
+	while (off < ctx->out_len) {
+		ssize_t n = write(ctx->out_fd, ctx->out_buf + off, ctx->out_len - off);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			ctx->out_len = 0;
+			return 1;
+		}
+		off += n;
+	}
+
+	ctx->out_len = 0;
+	return 0;
+}
+
+uint64_t sp_now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct sp_runner {
+	const struct splitter *sp;
+	struct sp_ctx ctx;
+	void *st; // NULL while not attached
+
+	long backoff_ms;
+	bool last_failed;
+	bool game_exited;
+	uint64_t deadline;
+
+	// adrift's messages on stdin, in sp_main only; -1 once it's closed
+	int in_fd;
+	size_t in_len;
+	char in_buf[64];
+};
+
+static void _runner_init(struct sp_runner *r, const struct splitter *sp) {
+	*r = (struct sp_runner){
+		.sp = sp,
+		.ctx = {
+			.pid = -1,
+			.pidfd = -1,
+			.initial_connect = true,
+			.out_fd = -1,
+		},
+		.st = NULL,
+		.backoff_ms = BACKOFF_MIN_MS,
+		.in_fd = -1,
+	};
+}
+
+static void _set_idle(struct sp_runner *r, bool idle) {
+	if (idle == r->ctx.idle) return;
+	r->ctx.idle = idle;
+
+	// Poll straight away when a run starts, rather than at the end of a
+	// long idle interval
+	if (!idle) r->deadline = sp_now_ms();
+}
+
+/* Try once to find the game and attach the splitter to it. Returns
+ * true on success. */
+static bool _attach(struct sp_runner *r) {
+	struct sp_ctx *ctx = &r->ctx;
+
+	ctx->pid = sp_find_process(r->sp->process_name);
+
+	if (ctx->pid < 0) {
+		fprintf(stderr, "[ERR] Could not find %s process\n", r->sp->process_name);
+		return false;
+	}
+
+	fprintf(stderr, "[LOG] Using process %d\n", ctx->pid);
+
+	ctx->pidfd = syscall(SYS_pidfd_open, ctx->pid, 0);
+	if (ctx->pidfd == -1) {
+		fprintf(stderr, "[WARN] pidfd_open failed with errno %d; game exit will only be noticed on a failed read\n", errno);
+	}
+
+	r->st = r->sp->init(ctx);
+	if (!r->st) {
+		if (ctx->pidfd != -1) close(ctx->pidfd);
+		ctx->pidfd = -1;
+		return false;
+	}
+
+	fputs("[LOG] Initialization completed!\n", stderr);
+	ctx->initial_connect = false;
+	r->game_exited = false;
+	return true;
+}
+
+static void _detach(struct sp_runner *r) {
+	if (r->st && r->sp->shutdown) r->sp->shutdown(r->st);
+	r->st = NULL;
+	if (r->ctx.pidfd != -1) close(r->ctx.pidfd);
+	r->ctx.pidfd = -1;
+}
+
+/* Do one step of attaching to or polling the game. Returns the number
+ * of milliseconds until the next step, or -1 if the splitter has failed
+ * and should exit. */
+static int _step(struct sp_runner *r) {
+	if (!r->st) {
+		if (!_attach(r)) {
+			// Back off exponentially while the game isn't running, so an
+			// idle splitter costs next to nothing on machines with many
+			// processes
+			int delay = r->backoff_ms;
+			r->backoff_ms *= 2;
+			if (r->backoff_ms > BACKOFF_MAX_MS) r->backoff_ms = BACKOFF_MAX_MS;
+			return delay;
+		}
+
+		r->backoff_ms = BACKOFF_MIN_MS;
+		r->deadline = sp_now_ms();
+	}
+
+	if (r->game_exited) {
+		fprintf(stderr, "[LOG] %s process exited\n", r->sp->process_name);
+		_detach(r);
+		return 0; // re-init
+	}
+
+	if (r->sp->update(&r->ctx, r->st)) {
+		_detach(r);
+		if (r->last_failed) return -1;
+		r->last_failed = true;
+		return 0; // re-init
+	}
+
+	r->last_failed = false;
+
+	// Polls are scheduled against fixed deadlines rather than sleeping for
+	// a fixed time after each one, so the poll rate doesn't drift with the
+	// time spent reading memory and writing output
+	bool slow = r->ctx.idle && r->sp->idle_poll_interval_ms > 0;
+	r->deadline += slow ? r->sp->idle_poll_interval_ms : r->sp->poll_interval_ms;
+	uint64_t now = sp_now_ms();
+	if (r->deadline < now) r->deadline = now; // We fell behind; don't try to catch up
+
+	return r->deadline - now;
+}
+
+/* Check whether the game process has exited, waiting for up to the
+ * given timeout. */
+static bool _wait_exit(struct sp_ctx *ctx, int timeout_ms) {
+	struct pollfd pfd = { .fd = ctx->pidfd, .events = POLLIN }; // poll ignores negative fds
+	return poll(&pfd, 1, timeout_ms) > 0 && (pfd.revents & POLLIN);
+}
+
+/* Read adrift's messages from stdin. Lines other than IDLE and ACTIVE
+ * are ignored, so more can be added. */
+static void _read_input(struct sp_runner *r) {
+	ssize_t n = read(r->in_fd, r->in_buf + r->in_len, sizeof r->in_buf - r->in_len);
+	if (n <= 0) {
+		if (n == -1 && errno == EINTR) return;
+		// adrift can't tell us anything, so keep polling at full speed
+		r->in_fd = -1;
+		_set_idle(r, false);
+		return;
+	}
+	r->in_len += n;
+
+	char *start = r->in_buf, *end = r->in_buf + r->in_len, *nl;
+	while ((nl = memchr(start, '\n', end - start))) {
+		*nl = 0;
+		if (!strcmp(start, "IDLE")) _set_idle(r, true);
+		else if (!strcmp(start, "ACTIVE")) _set_idle(r, false);
+		start = nl + 1;
+	}
+
+	r->in_len = end - start;
+	if (r->in_len == sizeof r->in_buf) r->in_len = 0; // Overlong line
+	memmove(r->in_buf, start, r->in_len);
+}
+
+/* Wait for up to the given timeout, waking early if the game exits or
+ * adrift says something. */
+static void _wait(struct sp_runner *r, int timeout_ms) {
+	struct pollfd pfds[] = {
+		{ .fd = r->ctx.pidfd, .events = POLLIN }, // poll ignores negative fds
+		{ .fd = r->in_fd, .events = POLLIN },
+	};
+
+	if (poll(pfds, 2, timeout_ms) <= 0) return;
+
+	if (pfds[0].revents & POLLIN) r->game_exited = true;
+	if (pfds[1].revents & (POLLIN | POLLHUP)) _read_input(r);
+}
+
+void *sp_plugin_init(const struct splitter *sp, const struct rift_host *host) {
+	struct sp_runner *r = malloc(sizeof *r);
+	if (!r) return NULL;
+	_runner_init(r, sp);
+	r->ctx.host = host;
+	return r;
+}
+
+int sp_plugin_update(void *u) {
+	struct sp_runner *r = u;
+	if (r->st && _wait_exit(&r->ctx, 0)) {
+		r->game_exited = true;
+	}
+	return _step(r);
+}
+
+void sp_plugin_shutdown(void *u) {
+	struct sp_runner *r = u;
+	_detach(r);
+	free(r);
+}
+
+void sp_plugin_set_active(void *u, int active) {
+	_set_idle(u, !active);
+}
+
+static int _out_fd;
+static char *_fifo_path;
+
+static void _cleanup(int sig) {
+	if (_fifo_path) {
+		close(_out_fd);
+		unlink(_fifo_path);
+	}
+	exit(0);
+}
+
+static int _usage(char *argv0) {
+	fprintf(stderr, "Usage: %s [fifo path]\n", argv0);
+	return 1;
+}
+
+int sp_main(const struct splitter *sp, int argc, char **argv) {
+	if (argc > 2) {
+		return _usage(argv[0]);
+	}
+
+	if (argc == 2 && !strcmp(argv[1], "-h")) {
+		return _usage(argv[0]);
+	}
+
+	_out_fd = STDOUT_FILENO;
+	_fifo_path = argc == 2 ? argv[1] : NULL;
+
+	if (_fifo_path) {
+		if (mkfifo(_fifo_path, 0644) == -1) {
+			fprintf(stderr, "[ERR] Failed to create FIFO '%s': error %d\n", _fifo_path, errno);
+			return 1;
+		}
+
+		_out_fd = open(_fifo_path, O_WRONLY);
+		if (_out_fd == -1) {
+			fprintf(stderr, "[ERR] Failed to open '%s': error %d\n", _fifo_path, errno);
+			unlink(_fifo_path);
+			return 1;
+		}
+	}
+
+	struct sigaction act = {
+		.sa_handler = _cleanup,
+	};
+	sigaction(SIGINT, &act, NULL);
+
+	struct sp_runner r;
+	_runner_init(&r, sp);
+	r.ctx.out_fd = _out_fd;
+	r.in_fd = STDIN_FILENO;
+
+	while (true) {
+		int delay = _step(&r);
+		sp_flush(&r.ctx);
+
+		if (delay < 0) {
+			if (_fifo_path) {
+				close(_out_fd);
+				unlink(_fifo_path);
+			}
+			return 1;
+		}
+
+		// Sleep until the next step, waking early if the game exits or a
+		// run starts
+		uint64_t wake = sp_now_ms() + delay;
+		do {
+			_wait(&r, delay);
+			uint64_t now = sp_now_ms();
+			delay = r.game_exited || !r.ctx.idle || now >= wake ? 0 : wake - now;
+		} while (delay > 0);
+	}
+
+	return 0;
+}
@@ -0,0 +1,198 @@
+#ifndef SPLITTER_H
+#define SPLITTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "rift_plugin.h"
+
+/* A small library for writing rift autosplitters which read the memory
+ * of a game process. A splitter describes itself with a struct splitter
+ * and hands control to sp_main, which deals with finding the game,
+ * reconnecting when it restarts, scheduling polls and writing the rift
+ * stream. The same splitter can also be built as a shared object which
+ * adrift loads in-process; see SP_PLUGIN. */
+
+enum sp_event {
+	SP_EV_TIME = RIFT_EV_TIME,
+	SP_EV_BEGIN = RIFT_EV_BEGIN,
+	SP_EV_SPLIT = RIFT_EV_SPLIT,
+	SP_EV_RESET = RIFT_EV_RESET,
+	SP_EV_PAUSE = RIFT_EV_PAUSE,
+	SP_EV_RESUME = RIFT_EV_RESUME,
+};
+
+struct sp_range {
+	struct sp_range *next;
+	void *start;
+	size_t len;
+	bool readable;
+};
+
+/* A single read of len bytes at addr in the game's memory into buf. */
+struct sp_read {
+	const void *addr;
+	void *buf;
+	size_t len;
+};
+
+struct sp_ctx {
+	pid_t pid;
+	int pidfd; // -1 if pidfd_open is unsupported
+
+	// True on the first attach since the splitter started, false when
+	// reconnecting after the game restarted
+	bool initial_connect;
+
+	// When running as a plugin, events go straight to the host rather
+	// than being written to out_fd
+	const struct rift_host *host;
+
+	// Set while adrift has told us no run is in progress
+	bool idle;
+
+	int out_fd;
+	size_t out_len;
+	char out_buf[1024];
+};
+
+struct splitter {
+	// Basename of the game executable, as in its cmdline
+	const char *process_name;
+	int poll_interval_ms;
+	// Used instead while no run is in progress, if nonzero
+	int idle_poll_interval_ms;
+
+	// Attach to the game after it has been found. Returns the splitter's
+	// state, or NULL if the game isn't ready yet and we should retry
+	void *(*init)(struct sp_ctx *ctx);
+	// Poll the game and emit any events. Returns 0 on success
+	int (*update)(struct sp_ctx *ctx, void *st);
+	void (*shutdown)(void *st);
+};
+
+/* Find a process whose executable has the given basename, returning its
+ * pid or -1 if there is none. */
+pid_t sp_find_process(const char *name);
+
+/* Read and parse /proc/<pid>/maps and return a linked list of all the
+ * address ranges in the program, lowest first. If heap_only is true,
+ * only return address ranges labelled '[heap]'. */
+struct sp_range *sp_get_ranges(pid_t pid, bool heap_only);
+void sp_free_ranges(struct sp_range *r);
+
+/* Search the game's memory for match_len bytes beginning with the given
+ * needle, for which check (if not NULL) returns true. Returns the address
+ * of the match in the game's memory, or NULL if none was found. */
+void *sp_scan(struct sp_ctx *ctx, bool heap_only, const void *needle, size_t needle_len, size_t match_len, bool (*check)(const char *match, void *u), void *u);
+
+/* A compiled array-of-bytes signature. */
+struct sp_pattern {
+	size_t len;
+	uint8_t *bytes; // Pre-masked, so wildcards are 0
+	uint8_t *mask; // 0xFF for fixed bytes, 0x00 for wildcards
+	// Index of the fixed byte least likely to appear in memory, which is
+	// searched for first
+	size_t anchor;
+
+	// Address of the first match in the game's memory after sp_sigscan,
+	// or NULL if the pattern wasn't found
+	void *addr;
+};
+
+/* Compile a pattern given as space-separated hex bytes, where '?' or
+ * '??' matches any byte, e.g. "48 8B ?? ?? 89". Returns 0 on success. */
+int sp_pattern_compile(struct sp_pattern *p, const char *str);
+void sp_pattern_free(struct sp_pattern *p);
+
+/* Search every readable mapping of the game for all of the given
+ * patterns at once, setting their addr fields. Each mapping is read
+ * from the game exactly once. Returns the number of patterns found. */
+size_t sp_sigscan(struct sp_ctx *ctx, struct sp_pattern *pats, size_t npats);
+
+/* Resolve a RIP-relative operand: read the 32-bit displacement at
+ * addr + rel_off and return the address it refers to relative to the
+ * end of the instruction, addr + instr_len. Returns NULL on failure. */
+void *sp_resolve_rel32(struct sp_ctx *ctx, void *addr, size_t rel_off, size_t instr_len);
+
+/* Read from the game's memory. Returns 0 on success. */
+int sp_read(struct sp_ctx *ctx, const void *addr, void *buf, size_t len);
+
+/* Perform every read in the list, using as few syscalls as possible.
+ * Returns 0 if every read succeeded in full. */
+int sp_read_many(struct sp_ctx *ctx, const struct sp_read *reads, size_t n);
+
+/* A list of values in the game's memory which are all read together on
+ * each poll. Values are given either by address, or by a pointer path:
+ * starting from base, each offset is added to the pointer read from the
+ * current address, so a path {0x10, 0x8} from base names the value at
+ * *(*base + 0x10) + 0x8. A poll costs one process_vm_readv for all the
+ * values, plus one per level of pointer indirection, however many values
+ * are watched. */
+struct sp_watch;
+
+/* Create a watch list for a game whose pointers are ptr_size (4 or 8)
+ * bytes wide. */
+struct sp_watch *sp_watch_new(size_t ptr_size);
+void sp_watch_free(struct sp_watch *w);
+
+/* Watch len bytes at addr. Returns the index of the value, or -1 on
+ * allocation failure. */
+int sp_watch_add(struct sp_watch *w, const void *addr, size_t len);
+
+/* Watch len bytes at the end of a pointer path. The offsets are copied.
+ * Returns the index of the value, or -1 on allocation failure. */
+int sp_watch_add_path(struct sp_watch *w, const void *base, const ptrdiff_t *offsets, size_t noffsets, size_t len);
+
+/* Read every watched value into a new snapshot, keeping the previous
+ * one. Returns 0 if every value was read, or the number of values which
+ * could not be (e.g. because a pointer path was broken). */
+size_t sp_watch_poll(struct sp_ctx *ctx, struct sp_watch *w);
+
+/* The value from the latest or previous snapshot, or NULL if it couldn't
+ * be read in that poll. */
+const void *sp_watch_get(struct sp_watch *w, int idx);
+const void *sp_watch_prev(struct sp_watch *w, int idx);
+
+/* Whether the value differs between the latest and previous snapshots. */
+bool sp_watch_changed(struct sp_watch *w, int idx);
+
+/* CLOCK_MONOTONIC in milliseconds, for rate-limiting output. */
+uint64_t sp_now_ms(void);
+
+/* Queue a rift event. Output is buffered and written once per poll. */
+void sp_emit(struct sp_ctx *ctx, enum sp_event ev, uint64_t usec);
+int sp_flush(struct sp_ctx *ctx);
+
+/* Run the splitter until interrupted. argv may contain a FIFO path to
+ * write to instead of stdout. adrift writes IDLE and ACTIVE lines to the
+ * splitter's stdin as runs end and start; until it does, or if stdin is
+ * closed, the splitter counts as active. */
+int sp_main(const struct splitter *sp, int argc, char **argv);
+
+/* The rift plugin entry points for a splitter; use SP_PLUGIN rather than
+ * calling these directly. */
+void *sp_plugin_init(const struct splitter *sp, const struct rift_host *host);
+int sp_plugin_update(void *u);
+void sp_plugin_shutdown(void *u);
+void sp_plugin_set_active(void *u, int active);
+
+/* Export the given struct splitter as a rift plugin, so that the file
+ * can be built as a shared object as well as an executable. */
+#define SP_PLUGIN(splitter) \
+	static void *_sp_plugin_init(const struct rift_host *host) { \
+		return sp_plugin_init(&(splitter), host); \
+	} \
+	static const struct rift_plugin _sp_plugin = { \
+		.abi_version = RIFT_PLUGIN_ABI_VERSION, \
+		.init = _sp_plugin_init, \
+		.update = sp_plugin_update, \
+		.shutdown = sp_plugin_shutdown, \
+		.set_active = sp_plugin_set_active, \
+	}; \
+	const struct rift_plugin *rift_plugin_entry(void) { \
+		return &_sp_plugin; \
+	}
+
+#endif
@@ -0,0 +1,257 @@
+#define _GNU_SOURCE
+
+#include "splitter.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Maximum number of iovecs the kernel accepts in one process_vm_readv
+#define SP_IOV_MAX 1024
+
+struct _watch_entry {
+	const void *base;
+	ptrdiff_t *offsets;
+	size_t noffsets;
+	size_t len;
+
+	// Offset of the value in each snapshot buffer
+	size_t off;
+
+	// Scratch used while polling
+	const void *addr;
+	bool ok;
+	uint64_t ptr;
+};
+
+struct sp_watch {
+	size_t ptr_size;
+
+	size_t n, cap;
+	struct _watch_entry *ents;
+	size_t max_depth;
+
+	// Double-buffered snapshots; data[cur] is the latest
+	int cur;
+	size_t data_len;
+	uint8_t *data[2];
+	uint64_t *valid[2];
+	uint64_t *changed;
+
+	// Scratch for building batches of reads, with room for every entry
+	struct iovec *local, *remote;
+	size_t *iov_ent;
+};
+
+static inline bool _bit_get(const uint64_t *bm, size_t i) {
+	return bm[i / 64] >> (i % 64) & 1;
+}
+
+static inline void _bit_set(uint64_t *bm, size_t i, bool v) {
+	if (v) bm[i / 64] |= (uint64_t)1 << (i % 64);
+	else bm[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+struct sp_watch *sp_watch_new(size_t ptr_size) {
+	struct sp_watch *w = calloc(1, sizeof *w);
+	if (!w) return NULL;
+	w->ptr_size = ptr_size;
+	return w;
+}
+
+void sp_watch_free(struct sp_watch *w) {
+	if (!w) return;
+	for (size_t i = 0; i < w->n; ++i) {
+		free(w->ents[i].offsets);
+	}
+	free(w->ents);
+	free(w->data[0]);
+	free(w->data[1]);
+	free(w->valid[0]);
+	free(w->valid[1]);
+	free(w->changed);
+	free(w->local);
+	free(w->remote);
+	free(w->iov_ent);
+	free(w);
+}
+
+static bool _grow(struct sp_watch *w, size_t len) {
+	if (w->n == w->cap) {
+		size_t cap = w->cap ? w->cap * 2 : 16;
+		size_t words = (cap + 63) / 64, old_words = (w->cap + 63) / 64;
+
+		void *p;
+#define GROW(field, sz) \
+		if (!(p = realloc(w->field, (sz)))) return false; \
+		w->field = p;
+
+		GROW(ents, cap * sizeof w->ents[0]);
+		GROW(local, cap * sizeof w->local[0]);
+		GROW(remote, cap * sizeof w->remote[0]);
+		GROW(iov_ent, cap * sizeof w->iov_ent[0]);
+		GROW(valid[0], words * sizeof (uint64_t));
+		GROW(valid[1], words * sizeof (uint64_t));
+		GROW(changed, words * sizeof (uint64_t));
+
+#undef GROW
+
+		for (size_t i = old_words; i < words; ++i) {
+			w->valid[0][i] = w->valid[1][i] = w->changed[i] = 0;
+		}
+
+		w->cap = cap;
+	}
+
+	for (int i = 0; i < 2; ++i) {
+		void *p = realloc(w->data[i], w->data_len + len);
+		if (!p) return false;
+		memset((uint8_t *)p + w->data_len, 0, len);
+		w->data[i] = p;
+	}
+
+	return true;
+}
+
+int sp_watch_add_path(struct sp_watch *w, const void *base, const ptrdiff_t *offsets, size_t noffsets, size_t len) {
+	if (!_grow(w, len)) return -1;
+
+	ptrdiff_t *offs = NULL;
+	if (noffsets) {
+		offs = malloc(noffsets * sizeof offs[0]);
+		if (!offs) return -1;
+		memcpy(offs, offsets, noffsets * sizeof offs[0]);
+	}
+
+	w->ents[w->n] = (struct _watch_entry){
+		.base = base,
+		.offsets = offs,
+		.noffsets = noffsets,
+		.len = len,
+		.off = w->data_len,
+	};
+
+	w->data_len += len;
+	if (noffsets > w->max_depth) w->max_depth = noffsets;
+
+	return w->n++;
+}
+
+int sp_watch_add(struct sp_watch *w, const void *addr, size_t len) {
+	return sp_watch_add_path(w, addr, NULL, 0, len);
+}
+
+/* Perform a batch of reads, setting the ok flag of the entry behind each
+ * one. process_vm_readv stops at the first remote iovec it can't read,
+ * so on failure we skip that read and carry on from the next; a batch
+ * with no failures costs a single syscall. */
+static void _readv(struct sp_ctx *ctx, struct sp_watch *w, size_t n) {
+	size_t i = 0;
+
+	while (i < n) {
+		size_t batch = n - i > SP_IOV_MAX ? SP_IOV_MAX : n - i;
+		ssize_t got = syscall(SYS_process_vm_readv, ctx->pid, w->local + i, batch, w->remote + i, batch, 0);
+		if (got < 0) got = 0;
+
+		size_t end = i + batch;
+		while (i < end && (size_t)got >= w->remote[i].iov_len) {
+			got -= w->remote[i].iov_len;
+			w->ents[w->iov_ent[i]].ok = true;
+			++i;
+		}
+
+		if (i < end) {
+			w->ents[w->iov_ent[i]].ok = false;
+			++i;
+		}
+	}
+}
+
+size_t sp_watch_poll(struct sp_ctx *ctx, struct sp_watch *w) {
+	w->cur ^= 1;
+
+	for (size_t i = 0; i < w->n; ++i) {
+		w->ents[i].addr = w->ents[i].base;
+		w->ents[i].ok = true;
+	}
+
+	// Resolve pointer paths a level at a time, reading the pointers of
+	// every path at that level in one batch
+	for (size_t level = 0; level < w->max_depth; ++level) {
+		size_t n = 0;
+
+		for (size_t i = 0; i < w->n; ++i) {
+			struct _watch_entry *e = &w->ents[i];
+			if (!e->ok || e->noffsets <= level) continue;
+			e->ptr = 0;
+			w->local[n] = (struct iovec){ &e->ptr, w->ptr_size };
+			w->remote[n] = (struct iovec){ (void *)e->addr, w->ptr_size };
+			w->iov_ent[n] = i;
+			++n;
+		}
+
+		_readv(ctx, w, n);
+
+		for (size_t j = 0; j < n; ++j) {
+			struct _watch_entry *e = &w->ents[w->iov_ent[j]];
+			if (!e->ok) continue;
+
+			uint64_t ptr = e->ptr;
+			if (w->ptr_size == 4) {
+				uint32_t ptr32;
+				memcpy(&ptr32, &e->ptr, sizeof ptr32);
+				ptr = ptr32;
+			}
+
+			if (!ptr) {
+				e->ok = false;
+			} else {
+				e->addr = (const char *)(uintptr_t)ptr + e->offsets[level];
+			}
+		}
+	}
+
+	// Read the values themselves
+	size_t n = 0;
+	for (size_t i = 0; i < w->n; ++i) {
+		struct _watch_entry *e = &w->ents[i];
+		if (!e->ok) continue;
+		w->local[n] = (struct iovec){ w->data[w->cur] + e->off, e->len };
+		w->remote[n] = (struct iovec){ (void *)e->addr, e->len };
+		w->iov_ent[n] = i;
+		++n;
+	}
+
+	_readv(ctx, w, n);
+
+	uint8_t *cur = w->data[w->cur], *prev = w->data[!w->cur];
+	size_t nfailed = 0;
+
+	for (size_t i = 0; i < w->n; ++i) {
+		struct _watch_entry *e = &w->ents[i];
+		bool was_valid = _bit_get(w->valid[!w->cur], i);
+
+		_bit_set(w->valid[w->cur], i, e->ok);
+		if (!e->ok) ++nfailed;
+
+		bool changed = e->ok != was_valid || (e->ok && memcmp(cur + e->off, prev + e->off, e->len));
+		_bit_set(w->changed, i, changed);
+	}
+
+	return nfailed;
+}
+
+const void *sp_watch_get(struct sp_watch *w, int idx) {
+	if (!_bit_get(w->valid[w->cur], idx)) return NULL;
+	return w->data[w->cur] + w->ents[idx].off;
+}
+
+const void *sp_watch_prev(struct sp_watch *w, int idx) {
+	if (!_bit_get(w->valid[!w->cur], idx)) return NULL;
+	return w->data[!w->cur] + w->ents[idx].off;
+}
+
+bool sp_watch_changed(struct sp_watch *w, int idx) {
+	return _bit_get(w->changed, idx);
+}
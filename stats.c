@@ -0,0 +1,204 @@
+#include "stats.h"
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *const _subsys_names[STATS_NSUBSYS] = {
+	[STATS_IO] = "io",
+	[STATS_DRAW] = "draw",
+	[STATS_TIMER] = "timer",
+	[STATS_CONFIG] = "config",
+	[STATS_INPUT] = "input",
+	[STATS_OTHER] = "other",
+};
+
+// Only set before any other thread is started
+static bool _enabled;
+
+static atomic_uint_fast64_t _allocs[STATS_NSUBSYS];
+static atomic_int_fast64_t _live;
+static atomic_int_fast64_t _peak;
+static atomic_uint_fast64_t _frames;
+static atomic_uint_fast64_t _splits;
+
+static long _interval;
+static struct timespec _start;
+static thrd_t _thread;
+static mtx_t _lock;
+static cnd_t _cnd;
+static bool _stopping;
+
+// As of the last line, for the rates over each interval
+static uint_fast64_t _last_total, _last_draw, _last_frames, _last_splits;
+
+// Count an allocation, or a reallocation from a block of old bytes
+static void _count(enum stats_subsys sub, size_t old, void *p) {
+	atomic_fetch_add_explicit(&_allocs[sub], 1, memory_order_relaxed);
+
+	int_fast64_t delta = (int_fast64_t)malloc_usable_size(p) - (int_fast64_t)old;
+	int_fast64_t live = atomic_fetch_add_explicit(&_live, delta, memory_order_relaxed) + delta;
+
+	int_fast64_t peak = atomic_load_explicit(&_peak, memory_order_relaxed);
+	while (live > peak && !atomic_compare_exchange_weak_explicit(&_peak, &peak, live, memory_order_relaxed, memory_order_relaxed));
+}
+
+void *stats_malloc(enum stats_subsys sub, size_t size) {
+	void *p = malloc(size);
+	if (_enabled && p) _count(sub, 0, p);
+	return p;
+}
+
+void *stats_calloc(enum stats_subsys sub, size_t n, size_t size) {
+	void *p = calloc(n, size);
+	if (_enabled && p) _count(sub, 0, p);
+	return p;
+}
+
+void *stats_realloc(enum stats_subsys sub, void *p, size_t size) {
+	size_t old = _enabled && p ? malloc_usable_size(p) : 0;
+	void *q = realloc(p, size);
+	if (_enabled && q) _count(sub, old, q);
+	return q;
+}
+
+void stats_free(void *p) {
+	if (_enabled && p) atomic_fetch_sub_explicit(&_live, malloc_usable_size(p), memory_order_relaxed);
+	free(p);
+}
+
+char *stats_strdup(enum stats_subsys sub, const char *s) {
+	char *p = strdup(s);
+	if (_enabled && p) _count(sub, 0, p);
+	return p;
+}
+
+char *stats_strndup(enum stats_subsys sub, const char *s, size_t n) {
+	char *p = strndup(s, n);
+	if (_enabled && p) _count(sub, 0, p);
+	return p;
+}
+
+// getline only allocates when the line doesn't fit in the buffer it's
+// given, so this only counts when the buffer changed
+ssize_t stats_getline(enum stats_subsys sub, char **line, size_t *n, FILE *f) {
+	char *prev = *line;
+	size_t old = _enabled && prev ? malloc_usable_size(prev) : 0;
+
+	ssize_t ret = getline(line, n, f);
+
+	if (_enabled && *line && (*line != prev || malloc_usable_size(*line) != old)) {
+		_count(sub, old, *line);
+	}
+
+	return ret;
+}
+
+void stats_frame(void) {
+	if (_enabled) atomic_fetch_add_explicit(&_frames, 1, memory_order_relaxed);
+}
+
+void stats_split(void) {
+	if (_enabled) atomic_fetch_add_explicit(&_splits, 1, memory_order_relaxed);
+}
+
+static long _rss(void) {
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (!f) return -1;
+
+	long size, resident;
+	bool ok = fscanf(f, "%ld %ld", &size, &resident) == 2;
+	fclose(f);
+
+	return ok ? resident * sysconf(_SC_PAGESIZE) : -1;
+}
+
+static void _print_rate(const char *label, uint_fast64_t n, uint_fast64_t per) {
+	if (per) {
+		printf(" %s=%.2f", label, (double)n / per);
+	} else {
+		printf(" %s=-", label);
+	}
+}
+
+// A line of key=value pairs, with rates over the time since the last line
+static void _report(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double t = (now.tv_sec - _start.tv_sec) + (now.tv_nsec - _start.tv_nsec) / 1e9;
+
+	uint_fast64_t allocs[STATS_NSUBSYS], total = 0;
+	for (int i = 0; i < STATS_NSUBSYS; ++i) {
+		allocs[i] = atomic_load_explicit(&_allocs[i], memory_order_relaxed);
+		total += allocs[i];
+	}
+
+	uint_fast64_t frames = atomic_load_explicit(&_frames, memory_order_relaxed);
+	uint_fast64_t splits = atomic_load_explicit(&_splits, memory_order_relaxed);
+
+	printf("t=%.1f allocs=%"PRIuFAST64, t, total);
+	for (int i = 0; i < STATS_NSUBSYS; ++i) {
+		printf(" %s=%"PRIuFAST64, _subsys_names[i], allocs[i]);
+	}
+
+	printf(" frames=%"PRIuFAST64" splits=%"PRIuFAST64, frames, splits);
+	_print_rate("frame_allocs", allocs[STATS_DRAW] - _last_draw, frames - _last_frames);
+	_print_rate("split_allocs", total - _last_total, splits - _last_splits);
+
+	printf(" live=%"PRIdFAST64" peak=%"PRIdFAST64" rss=%ld\n",
+		atomic_load_explicit(&_live, memory_order_relaxed),
+		atomic_load_explicit(&_peak, memory_order_relaxed),
+		_rss());
+	fflush(stdout);
+
+	_last_total = total;
+	_last_draw = allocs[STATS_DRAW];
+	_last_frames = frames;
+	_last_splits = splits;
+}
+
+static int _stats_main(void *data) {
+	struct timespec next;
+	// cnd_timedwait waits until a time of the realtime clock
+	clock_gettime(CLOCK_REALTIME, &next);
+
+	mtx_lock(&_lock);
+
+	while (!_stopping) {
+		next.tv_sec += _interval;
+		while (!_stopping && cnd_timedwait(&_cnd, &_lock, &next) == thrd_success);
+		if (!_stopping) _report();
+	}
+
+	mtx_unlock(&_lock);
+
+	return 0;
+}
+
+void stats_start(long interval) {
+	_interval = interval > 0 ? interval : 1;
+	clock_gettime(CLOCK_MONOTONIC, &_start);
+	_enabled = true;
+
+	if (mtx_init(&_lock, mtx_plain) != thrd_success || cnd_init(&_cnd) != thrd_success || thrd_create(&_thread, _stats_main, NULL) != thrd_success) {
+		fputs("Warning: failed to start stats thread, only reporting at exit\n", stderr);
+		_interval = 0;
+	}
+}
+
+void stats_stop(void) {
+	if (!_enabled) return;
+
+	if (_interval) {
+		mtx_lock(&_lock);
+		_stopping = true;
+		cnd_signal(&_cnd);
+		mtx_unlock(&_lock);
+		thrd_join(_thread, NULL);
+	}
+
+	_report();
+}
@@ -0,0 +1,58 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+// Allocation statistics, for --stats. A source file defines STATS_SUBSYS
+// and includes this after everything else, so that its allocations are
+// counted against that subsystem. Until stats_start is called, the
+// wrappers do nothing more than what they wrap.
+//
+// Live bytes are counted by the size of each block, so memory may be
+// freed by a different subsystem than allocated it, but everything freed
+// through the wrappers must have been allocated through them
+
+enum stats_subsys {
+	STATS_IO,
+	STATS_DRAW,
+	STATS_TIMER,
+	STATS_CONFIG,
+	STATS_INPUT,
+	STATS_OTHER,
+	STATS_NSUBSYS,
+};
+
+// Start counting, and write a line of stats to stdout every interval
+// seconds. Must be called before anything is allocated through the
+// wrappers
+void stats_start(long interval);
+// Write a last line and stop
+void stats_stop(void);
+// Count a frame drawn, or a split
+void stats_frame(void);
+void stats_split(void);
+
+void *stats_malloc(enum stats_subsys sub, size_t size);
+void *stats_calloc(enum stats_subsys sub, size_t n, size_t size);
+void *stats_realloc(enum stats_subsys sub, void *p, size_t size);
+void stats_free(void *p);
+char *stats_strdup(enum stats_subsys sub, const char *s);
+char *stats_strndup(enum stats_subsys sub, const char *s, size_t n);
+ssize_t stats_getline(enum stats_subsys sub, char **line, size_t *n, FILE *f);
+
+#ifdef STATS_SUBSYS
+#define malloc(size) stats_malloc(STATS_SUBSYS, size)
+#define calloc(n, size) stats_calloc(STATS_SUBSYS, n, size)
+#define realloc(p, size) stats_realloc(STATS_SUBSYS, p, size)
+#define free(p) stats_free(p)
+#define strdup(s) stats_strdup(STATS_SUBSYS, s)
+#define strndup(s, n) stats_strndup(STATS_SUBSYS, s, n)
+#define getline(line, n, f) stats_getline(STATS_SUBSYS, line, n, f)
+#endif
+
+#endif
@@ -0,0 +1,129 @@
+#include "store.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t _mix(size_t slot, uint64_t val) {
+	uint64_t x = val ^ (slot * 0x9e3779b97f4a7c15);
+	x ^= x >> 31;
+	x *= 0xbf58476d1ce4e5b9;
+	x ^= x >> 29;
+	return x;
+}
+
+static uint64_t _checksum(struct store *st) {
+	uint64_t sum = 0;
+	for (size_t i = 0; i < st->hdr->nslots; ++i) {
+		sum += _mix(i, st->slots[i]);
+	}
+	return sum;
+}
+
+static bool _map(struct store *st, int fd, size_t nslots) {
+	st->len = sizeof (struct store_hdr) + nslots * sizeof (uint64_t);
+
+	void *addr = mmap(NULL, st->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		close(fd);
+		st->fd = -1;
+		return false;
+	}
+
+	st->fd = fd;
+	st->hdr = addr;
+	st->slots = (uint64_t *)(st->hdr + 1);
+	return true;
+}
+
+bool store_open(struct store *st, const char *path, size_t nslots) {
+	st->fd = -1;
+
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd == -1) return false;
+
+	struct stat sb;
+	if (fstat(fd, &sb) == -1 || (size_t)sb.st_size != sizeof (struct store_hdr) + nslots * sizeof (uint64_t)) {
+		close(fd);
+		return false;
+	}
+
+	if (!_map(st, fd, nslots)) return false;
+
+	if (memcmp(st->hdr->magic, STORE_MAGIC, sizeof st->hdr->magic) || st->hdr->version != STORE_VERSION || st->hdr->nslots != nslots || st->hdr->checksum != _checksum(st)) {
+		fprintf(stderr, "Warning: ignoring corrupt store %s\n", path);
+		store_close(st);
+		return false;
+	}
+
+	return true;
+}
+
+bool store_create(struct store *st, const char *path, size_t nslots) {
+	st->fd = -1;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd == -1) return false;
+
+	if (ftruncate(fd, sizeof (struct store_hdr) + nslots * sizeof (uint64_t)) == -1) {
+		close(fd);
+		return false;
+	}
+
+	if (!_map(st, fd, nslots)) return false;
+
+	memcpy(st->hdr->magic, STORE_MAGIC, sizeof st->hdr->magic);
+	st->hdr->version = STORE_VERSION;
+	st->hdr->nslots = nslots;
+	for (size_t i = 0; i < nslots; ++i) {
+		st->slots[i] = UINT64_MAX;
+	}
+	st->hdr->checksum = _checksum(st);
+
+	store_sync(st, SIZE_MAX);
+
+	return true;
+}
+
+void store_close(struct store *st) {
+	if (st->fd == -1) return;
+	munmap(st->hdr, st->len);
+	close(st->fd);
+	st->fd = -1;
+}
+
+void store_set(struct store *st, size_t slot, uint64_t val) {
+	if (st->fd == -1 || slot >= st->hdr->nslots) return;
+
+	st->hdr->checksum += _mix(slot, val) - _mix(slot, st->slots[slot]);
+	st->slots[slot] = val;
+}
+
+void store_sync(struct store *st, size_t slot) {
+	if (st->fd == -1) return;
+
+	// Writes through the mapping don't reliably update the modification
+	// time. Only changing times does, not closing: the pb link moves to a
+	// PB run when it finishes, before its times reach the store at the
+	// reset, and must stay newer until then
+	futimens(st->fd, NULL);
+
+	// The mapping is shared, so the kernel already has the data and it
+	// survives adrift crashing; this just starts writing it back. The
+	// header and the first slots share the first page
+	size_t page = sysconf(_SC_PAGESIZE);
+	if (slot == SIZE_MAX) {
+		msync(st->hdr, st->len, MS_ASYNC);
+		return;
+	}
+
+	msync(st->hdr, page < st->len ? page : st->len, MS_ASYNC);
+
+	size_t off = (char *)&st->slots[slot] - (char *)st->hdr;
+	if (off >= page) {
+		size_t start = off / page * page;
+		msync((char *)st->hdr + start, st->len - start < page ? st->len - start : page, MS_ASYNC);
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A file of times with one slot per split, in id order, which is kept
+// memory-mapped so that setting a time is a single store. The file is a
+// struct store_hdr followed by a uint64_t for each slot, in host byte
+// order, with UINT64_MAX for no time
+
+#define STORE_MAGIC "adriftT"
+#define STORE_VERSION 1
+
+struct store_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t nslots;
+	// A sum of a hash of every slot, so that it can be updated along with
+	// a single slot
+	uint64_t checksum;
+};
+
+struct store {
+	int fd; // -1 if not open
+	size_t len;
+	struct store_hdr *hdr;
+	uint64_t *slots;
+};
+
+#define STORE_INIT { .fd = -1 }
+
+// Open an existing store. Fails if it doesn't exist, is corrupt or has a
+// different number of slots
+bool store_open(struct store *st, const char *path, size_t nslots);
+// Create a store with every slot empty, replacing any existing file
+bool store_create(struct store *st, const char *path, size_t nslots);
+void store_close(struct store *st);
+
+void store_set(struct store *st, size_t slot, uint64_t val);
+// Ask for a slot, or every slot if slot is SIZE_MAX, to be written back,
+// and mark the store as newer than its text file
+void store_sync(struct store *st, size_t slot);
+
+#endif
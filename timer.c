@@ -1,13 +1,12 @@
 #include "timer.h"
 #include "io.h"
+#include "journal.h"
+#include "stats.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <unistd.h>
-#include <sys/stat.h>
-#include <sys/types.h>
+#include <time.h>
 
-#define RUNS_DIR "runs"
 // Microseconds you have to beat gold by for it to actually register - prevents rounding issues
 #define GOLD_EPSILON 10
 
@@ -27,28 +26,17 @@ static bool _update_expanded(int active_split, struct split *splits, size_t nspl
 	return expand;
 }
 
-static void _commit_pb(struct split *splits, size_t nsplits) {
+static void _commit_pb(struct state *s, struct split *splits, size_t nsplits) {
 	for (size_t i = 0; i < nsplits; ++i) {
 		if (splits[i].is_group) {
-			_commit_pb(splits[i].group.splits, splits[i].group.nsplits);
+			_commit_pb(s, splits[i].group.splits, splits[i].group.nsplits);
 		} else {
 			splits[i].split.times.pb = splits[i].split.times.cur;
+			store_set(&s->pb_store, splits[i].split.id, splits[i].split.times.pb);
 		}
 	}
 }
 
-static void _run_finish(struct state *s) {
-	struct split *final = get_final_split(s);
-	mkdir(RUNS_DIR, 0777);
-	char run_name[64];
-	strftime(run_name, sizeof run_name, RUNS_DIR "/%Y-%m-%d_%H.%M.%S", localtime(&s->run_started));
-	save_times(s->splits, s->nsplits, run_name, offsetof(struct times, cur));
-	if (final->split.times.cur < final->split.times.pb) {
-		unlink("pb");
-		symlink(run_name, "pb");
-	}
-}
-
 static void _clear_cur(struct split *splits, size_t nsplits) {
 	for (size_t i = 0; i < nsplits; ++i) {
 		if (splits[i].is_group) {
@@ -62,11 +50,14 @@ static void _clear_cur(struct split *splits, size_t nsplits) {
 
 void update_expanded(struct state *s) {
 	_update_expanded(s->active_split, s->splits, s->nsplits);
+	layout_splits(s);
+	s->static_gen++;
 }
 
 void timer_begin(struct state *s) {
 	s->active_split = 0;
 	s->run_started = time(NULL);
+	journal_append(JOURNAL_BEGIN, 0, s->run_started);
 	update_expanded(s);
 }
 
@@ -74,11 +65,14 @@ void timer_reset(struct state *s) {
 	if (s->active_split == -1) {
 		struct split *final = get_final_split(s);
 		if (final->split.times.cur < final->split.times.pb) {
-			_commit_pb(s->splits, s->nsplits);
+			_commit_pb(s, s->splits, s->nsplits);
+			store_sync(&s->pb_store, SIZE_MAX);
 		}
 	}
 	_clear_cur(s->splits, s->nsplits);
 	s->active_split = -1;
+	s->resumed = false;
+	journal_append(JOURNAL_RESET, 0, 0);
 	update_expanded(s);
 }
 
@@ -87,74 +81,271 @@ void timer_split(struct state *s) {
 
 	struct split *sp = get_split_by_id(s, s->active_split);
 	sp->split.times.cur = s->timer;
+	journal_append(JOURNAL_SPLIT, sp->split.id, s->timer);
+
+	// If the previous split was skipped, split_time covers more than one
+	// segment, so it can't be a gold
+	bool prev_timed = s->active_split == 0 || get_split_by_id(s, s->active_split - 1)->split.times.cur != UINT64_MAX;
 
-	if (s->split_time < sp->split.times.best - GOLD_EPSILON) {
+	if (prev_timed && s->split_time < sp->split.times.best - GOLD_EPSILON) {
+		sp->split.times.prev_best = sp->split.times.best;
 		sp->split.times.best = s->split_time;
 		sp->split.times.golded_this_run = true;
-		save_times(s->splits, s->nsplits, "golds", offsetof(struct times, best));
+		store_set(&s->golds_store, sp->split.id, sp->split.times.best);
+		store_sync(&s->golds_store, sp->split.id);
 	}
 
 	if (sp == get_final_split(s)) {
 		s->active_split = -1;
-		_run_finish(s);
+		// The journal writes out the run, so the split isn't held up by it,
+		// unless there's no journal, such as for the server's sessions
+		if (!journal_append(JOURNAL_FINISH, sp->split.times.cur < sp->split.times.pb, s->timer) && s->profiles) {
+			journal_write_run(s->profiles[s->profile].dirfd, s);
+		}
 	} else {
 		s->active_split++;
 	}
 
 	update_expanded(s);
+	stats_split();
 }
 
 static void update_time(struct state *s, uint64_t time) {
 	uint64_t prev = 0;
 	if (s->active_split > 0) {
-		prev = get_split_by_id(s, s->active_split - 1)->split.times.cur;
+		prev = get_prev_cur(s, s->active_split);
 	}
 
 	s->timer = time;
 	s->split_time = time - prev;
 }
 
-void timer_parse(struct state *s, const char *str) {
-	char *end;
-	long us = strtol(str, &end, 10);
+// Anchor the interpolated time to a time just received
+static void _anchor(struct state *s, uint64_t time) {
+	s->anchor_timer = time;
+	s->anchor_mono = get_mono_us();
+}
+
+void timer_undo(struct state *s) {
+	struct split *sp;
+	struct split *final = get_final_split(s);
+
+	if (s->active_split > 0) {
+		sp = get_split_by_id(s, s->active_split - 1);
+	} else if (s->active_split == -1 && final->split.times.cur != UINT64_MAX) {
+		// Undoing the final split resumes a finished run
+		sp = final;
+	} else {
+		return;
+	}
 
-	if (end == str) {
-		goto err;
+	if (sp->split.times.golded_this_run) {
+		sp->split.times.best = sp->split.times.prev_best;
+		sp->split.times.golded_this_run = false;
+		store_set(&s->golds_store, sp->split.id, sp->split.times.best);
+		store_sync(&s->golds_store, sp->split.id);
 	}
 
+	sp->split.times.cur = UINT64_MAX;
+	s->active_split = sp->split.id;
+	journal_append(JOURNAL_UNDO, sp->split.id, 0);
+	update_time(s, s->timer);
+	update_expanded(s);
+}
+
+void timer_skip(struct state *s) {
+	if (s->active_split == -1) return;
+
+	// The final split can't be skipped, as that would end the run without
+	// a time
+	if (get_split_by_id(s, s->active_split) == get_final_split(s)) return;
+
+	journal_append(JOURNAL_SKIP, s->active_split, 0);
+	s->active_split++;
+	update_time(s, s->timer);
+	update_expanded(s);
+}
+
+void timer_resume(struct state *s, int active_split, uint64_t time, time_t started) {
+	s->active_split = active_split;
+	s->run_started = started;
+	update_time(s, time);
+	_anchor(s, time);
+
+	// Hold the time until the splitter sends one. It resets when it first
+	// connects, which mustn't throw the run away
+	s->paused = true;
+	s->resumed = active_split != -1;
+
+	update_expanded(s);
+}
+
+// The events, matched by length and then by name
+static const struct {
+	char name[8];
+	size_t len;
+	enum timer_event ev;
+} _event_names[] = {
+	{ "SPLIT", 5, TIMER_EV_SPLIT },
+	{ "BEGIN", 5, TIMER_EV_BEGIN },
+	{ "RESET", 5, TIMER_EV_RESET },
+	{ "PAUSE", 5, TIMER_EV_PAUSE },
+	{ "RESUME", 6, TIMER_EV_RESUME },
+};
+
+enum timer_parse_error timer_parse_line(const char *str, struct timer_line *line) {
+	*line = (struct timer_line){ .ev = TIMER_EV_NONE };
+
+	const char *p = str;
+
+	// Up to two times, each followed by a space or the end of the line
+	for (int field = 0; field < 2 && *p >= '0' && *p <= '9'; ++field) {
+		uint64_t val = 0;
+		do {
+			unsigned digit = *p - '0';
+			if (val > (UINT64_MAX - 1 - digit) / 10) return TIMER_PARSE_BAD_TIME;
+			val = val * 10 + digit;
+		} while (*++p >= '0' && *p <= '9');
+
+		if (*p == ' ') {
+			++p;
+		} else if (*p) {
+			return TIMER_PARSE_BAD_TIME;
+		}
+
+		if (field == 0) {
+			line->has_time = true;
+			line->time = val;
+		} else {
+			line->has_real_time = true;
+			line->real_time = val;
+		}
+	}
+
+	if (!*p) return TIMER_PARSE_OK;
+
+	const char *word = p;
+	while (*p >= 'A' && *p <= 'Z') ++p;
+	size_t len = p - word;
+	if (*p) return TIMER_PARSE_BAD_EVENT;
+
+	for (size_t i = 0; i < sizeof _event_names / sizeof _event_names[0]; ++i) {
+		if (_event_names[i].len == len && !memcmp(_event_names[i].name, word, len)) {
+			line->ev = _event_names[i].ev;
+			return TIMER_PARSE_OK;
+		}
+	}
+
+	return TIMER_PARSE_BAD_EVENT;
+}
+
+// stopped is whether the game time is standing still, if this is just a
+// time update
+static void _event(struct state *s, enum timer_event ev, uint64_t us, bool stopped) {
 	bool updated = false;
 
-	if (end[0] == ' ') {
-		++end;
-		if (!strcmp(end, "BEGIN")) {
-			timer_reset(s);
-			update_time(s, us);
-			timer_begin(s);
-			updated = true;
-		} else if (!strcmp(end, "RESET")) {
-			timer_reset(s);
+	// After resuming a run, a reset at a time no earlier than where the run
+	// got to is the splitter connecting, rather than the game resetting.
+	// Only the first event can be that, so a later reset always gets through
+	if (s->resumed && ev != TIMER_EV_NONE) {
+		s->resumed = false;
+		if (ev == TIMER_EV_RESET && us >= s->anchor_timer) ev = TIMER_EV_NONE;
+	}
+
+	switch (ev) {
+	case TIMER_EV_NONE:
+		s->paused = stopped;
+		break;
+	case TIMER_EV_PAUSE:
+		s->paused = true;
+		break;
+	default:
+		s->paused = false;
+		break;
+	}
+	_anchor(s, us);
+
+	switch (ev) {
+	case TIMER_EV_BEGIN:
+		timer_reset(s);
+		update_time(s, us);
+		timer_begin(s);
+		updated = true;
+		break;
+	case TIMER_EV_RESET:
+		timer_reset(s);
+		update_time(s, us);
+		updated = true;
+		break;
+	case TIMER_EV_SPLIT:
+		if (s->active_split != -1) {
 			update_time(s, us);
+			timer_split(s);
 			updated = true;
-		} else if (!strcmp(end, "SPLIT")) {
-			if (s->active_split != -1) {
-				update_time(s, us);
-				timer_split(s);
-				updated = true;
-			}
-		} else if (end[0] != '\0') {
-			goto err;
 		}
-	} else if (end[0] != '\0') {
-		goto err;
+		break;
+	case TIMER_EV_PAUSE:
+	case TIMER_EV_RESUME:
+	case TIMER_EV_NONE:
+		break;
 	}
 
 	if (!updated && s->active_split != -1) {
 		update_time(s, us);
 	}
+}
+
+// Without the real time, the same time again may just be a splitter
+// sending it twice, so it only keeps the timer stopped if it already was.
+// Stopping takes a PAUSE; any new time means the game time is moving
+static bool _stopped(struct state *s, uint64_t us) {
+	return us == s->anchor_timer && s->paused;
+}
+
+void timer_event(struct state *s, enum timer_event ev, uint64_t us) {
+	_event(s, ev, us, _stopped(s, us));
+}
+
+void timer_manual_reset(struct state *s) {
+	s->resumed = false;
+	timer_event(s, TIMER_EV_RESET, s->timer);
+}
+
+void timer_line(struct state *s, const struct timer_line *line) {
+	bool stopped;
+
+	// The game time has stopped if the real time moved on without it, and
+	// the same pair again changes nothing
+	if (line->has_real_time) {
+		stopped = line->real_time == s->anchor_real ? s->paused : line->time == s->anchor_timer;
+		s->anchor_real = line->real_time;
+	} else {
+		stopped = _stopped(s, line->time);
+	}
+
+	_event(s, line->ev, line->time, stopped);
+}
+
+bool timer_interpolate(struct state *s, uint64_t max_us) {
+	if (s->active_split == -1 || s->paused) return false;
+
+	uint64_t elapsed = get_mono_us() - s->anchor_mono;
+	if (elapsed > max_us) elapsed = max_us;
+
+	uint64_t time = s->anchor_timer + elapsed;
+	if (time == s->timer) return false;
+
+	update_time(s, time);
+	return true;
+}
+
+enum timer_parse_error timer_parse(struct state *s, const char *str) {
+	struct timer_line line;
 
-	return;
+	enum timer_parse_error err = timer_parse_line(str, &line);
+	if (err) return err;
+	if (!line.has_time) return TIMER_PARSE_NO_TIME;
 
-err:
-	fprintf(stderr, "Warning: bad splitter data! Got line '%s'\n", str);
-	return;
+	timer_line(s, &line);
+	return TIMER_PARSE_OK;
 }
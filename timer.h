@@ -3,9 +3,52 @@
 
 #include "common.h"
 
+enum timer_event {
+	TIMER_EV_NONE, // Just a time update
+	TIMER_EV_BEGIN,
+	TIMER_EV_RESET,
+	TIMER_EV_SPLIT,
+	TIMER_EV_PAUSE, // The game time has stopped, until it resumes
+	TIMER_EV_RESUME,
+};
+
+enum timer_parse_error {
+	TIMER_PARSE_OK,
+	TIMER_PARSE_BAD_TIME, // Too large, or followed by something other than a space
+	TIMER_PARSE_BAD_EVENT,
+	TIMER_PARSE_NO_TIME, // From timer_parse only, which needs a time
+};
+
+// A line of rift data: a game time, optionally followed by the real time,
+// then an event, each of which may be omitted
+struct timer_line {
+	bool has_time;
+	bool has_real_time;
+	uint64_t time;
+	uint64_t real_time;
+	enum timer_event ev;
+};
+
 void timer_begin(struct state *s);
 void timer_reset(struct state *s);
 void timer_split(struct state *s);
-void timer_parse(struct state *s, const char *str);
+void timer_undo(struct state *s);
+void timer_skip(struct state *s);
+// Restore a run from the journal, whose split times have already been set
+void timer_resume(struct state *s, int active_split, uint64_t time, time_t started);
+// Parse a line of rift data, in a single pass
+enum timer_parse_error timer_parse_line(const char *str, struct timer_line *line);
+void timer_event(struct state *s, enum timer_event ev, uint64_t us);
+// Reset at the current time for a hotkey or control client. Unlike a
+// splitter's reset, this always ends a run restored from the journal
+void timer_manual_reset(struct state *s);
+// Apply a parsed line which has a time. With the real time too, the timer
+// can tell a stopped game time from the same time sent again
+void timer_line(struct state *s, const struct timer_line *line);
+// Advance the displayed time by the time passed since the last update,
+// up to max_us, unless the timer is stopped. Returns whether it changed
+bool timer_interpolate(struct state *s, uint64_t max_us);
+// Parse a line of rift data with a time, and apply it
+enum timer_parse_error timer_parse(struct state *s, const char *str);
 
 #endif